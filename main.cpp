@@ -9,7 +9,8 @@ int main(int argc, char *argv[])
     QApplication a(argc, argv);
 
     OdfPreviewLib ods;
-    if (ods.open("./nakl.ods"))
+    // The preview shows the first pages while the rest is being parsed
+    if (ods.openProgressive("./nakl.ods"))
     {
         ods.preview();
         ods.close();
@@ -1,26 +1,116 @@
 #include <QDebug>
 #include <QtCore/QStringList>
+#include <QtCore/QBuffer>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QXmlStreamReader>
+#include <QtCore/QMetaObject>
+#include <QtCore/QThreadPool>
+#include <QtCore/QtMath>
+#include <QtGui/QPaintEngine>
+#include <QtGui/QPdfWriter>
+#include <QtPrintSupport/QPrintPreviewWidget>
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <algorithm>
+#include <climits>
 #include "odfpreviewlib.h"
+#include "odsinflatepipe.h"
+#include "odssnapshot.h"
 #include "quazip/quazip.h"
 #include "quazip/quazipfile.h"
 
 
-OdfPreviewLib::OdfPreviewLib(QWidget *parent) : QObject()
+static inline QStringRef attribute(const QXmlStreamAttributes& attrs, const char* name)
+{
+    return attrs.value(QLatin1String(name));
+}
+
+
+// Unlike clear(), erasing never shrinks the bucket table of the hash
+template <typename K, typename V>
+static void clearKeepingCapacity(QHash<K, V>& hash)
+{
+    typename QHash<K, V>::iterator it = hash.begin();
+    while (it != hash.end())
+        it = hash.erase(it);
+}
+
+
+static void toSnapshot(SnapshotBorder& to, const BorderStyle& from)
+{
+    to.size     = from.size;
+    to.type     = from.type;
+    to.color    = from.color;
+}
+
+static void fromSnapshot(BorderStyle& to, const SnapshotBorder& from)
+{
+    to.size     = from.size;
+    to.type     = Qt::PenStyle(from.type);
+    to.color    = from.color;
+    to.penId    = -1;
+}
+
+// Copies a snapshot section into a vector in one block
+template <typename T>
+static bool fromSnapshot(QVector<T>& to, const uchar* base, const SnapshotSection& section)
 {
-    printer         = new QPrinter();
-    printPreview    = new QPrintPreviewDialog(printer, parent);
+    if (section.size % sizeof(T) != 0)
+        return false;
+    to.resize(int(section.size / sizeof(T)));
+    if (section.size > 0)
+        memcpy(to.data(), base + section.offset, section.size);
+    return true;
+}
+
+
+// Makes the array view a snapshot section, nothing is copied
+template <typename T>
+static bool fromSnapshot(OdsArray<T>& to, const uchar* base, const SnapshotSection& section)
+{
+    if (section.size % sizeof(T) != 0 || section.size / sizeof(T) > quint64(INT_MAX))
+        return false;
+    to = OdsArray<T>::fromRawData(reinterpret_cast<const T*>(base + section.offset), int(section.size / sizeof(T)));
+    return true;
+}
 
-    printPreview->setWindowTitle("Preview Dialog");
-    Qt::WindowFlags flags(Qt::WindowTitleHint);
-    printPreview->setWindowFlags(flags);
 
-    connect(printPreview, SIGNAL(paintRequested(QPrinter*)), this, SLOT(draw(QPrinter*)));
+OdfPreviewLib::OdfPreviewLib(QWidget *parent) : QObject()
+{
+    styleLoads.storeRelease(0);
+    rasterDpi       = 0;
+    draftDpi        = 0;
+    pageImages.setMaxCost(0);          // preview cache is enabled by setPageCacheSize()
+    parentWidget    = parent;
+
+    // Printer and preview dialog are created by preview() and print() only,
+    // rendering to images and PDF files does not need them
+    printer         = nullptr;
+    printPreview    = nullptr;
+
+    loader          = nullptr;
+    publishTarget   = nullptr;
+    snapshotData    = nullptr;
+    loadingStyles   = false;
+    loadingContent  = false;
+    nextPublish     = 0;
+    loadedPending   = false;
+    loadedFinished  = false;
+    loadedOk        = false;
+
+    close();
 }
 
 
 OdfPreviewLib::~OdfPreviewLib()
 {
-    disconnect(printPreview, SIGNAL(paintRequested(QPrinter*)), this, SLOT(draw(QPrinter*)));
+    close();
+
+    if (printPreview != nullptr)
+        disconnect(printPreview, SIGNAL(paintRequested(QPrinter*)), this, SLOT(draw(QPrinter*)));
 
     delete printPreview;
     delete printer;
@@ -31,118 +121,1004 @@ bool OdfPreviewLib::open(const QString fileName)
 {
     bool lResult = false;
 
-    if (printer->isValid())
+    close();
+
+    const QString cacheFile = cacheFileName(fileName);
+    if (!cacheFile.isEmpty())
     {
-        if (unzip(fileName))
-        {
-            lResult = true;
-        }
+        if (loadSnapshot(cacheFile))
+            return true;
+        close();
+    }
+
+    if (unzip(fileName))
+    {
+        lResult = true;
+        if (!cacheFile.isEmpty())
+            saveSnapshot(cacheFile);
     }
 
     return lResult;
 }
 
 
+bool OdfPreviewLib::openProgressive(const QString fileName)
+{
+    close();
+
+    // Page styles are small and the first page needs them, so they are
+    // loaded before returning
+    if (!unzipStyles(fileName))
+        return false;
+
+    startLoader(fileName);
+    return true;
+}
+
+
+QFuture<bool> OdfPreviewLib::openAsync(const QString fileName)
+{
+    close();
+
+    // Page styles are parsed into this instance on another worker, the
+    // first snapshot of the loader waits for them before it is applied
+    stylesLoading = QtConcurrent::run(this, &OdfPreviewLib::unzipStyles, fileName);
+    loadingStyles = true;
+
+    startLoader(fileName);
+    return loadTask.future();
+}
+
+
+void OdfPreviewLib::setCacheDirectory(const QString& directory)
+{
+    cacheDirectory = directory;
+}
+
+
+QString OdfPreviewLib::cacheFileName(const QString& fileName) const
+{
+    if (cacheDirectory.isEmpty())
+        return QString();
+
+    // Only the central directory is read, no entry is inflated
+    QuaZip zip(fileName);
+    if (!zip.open(QuaZip::mdUnzip))
+        return QString();
+
+    QString key;
+    const char* const entries[] = {"content.xml", "styles.xml"};
+    for (int i = 0; i < 2; i++)
+    {
+        QuaZipFileInfo64 info;
+        if (!zip.setCurrentFile(entries[i]) || !zip.getCurrentFileInfo(&info))
+            return QString();
+        key += QString("%1-%2-").arg(info.crc, 8, 16, QChar('0')).arg(info.uncompressedSize);
+    }
+    zip.close();
+
+    return QDir(cacheDirectory).filePath(key + QString("%1.odss").arg(OdfPreviewLib_VERSION, 6, 16, QChar('0')));
+}
+
+
+bool OdfPreviewLib::openSnapshot(const QString fileName)
+{
+    close();
+
+    if (loadSnapshot(fileName))
+        return true;
+
+    close();
+    return false;
+}
+
+
+bool OdfPreviewLib::loadSnapshot(const QString& fileName)
+{
+    snapshotFile.setFileName(fileName);
+    if (!snapshotFile.open(QIODevice::ReadOnly))
+        return false;
+
+    // The mapping is kept until close(), names and text are used in place
+    const quint64 fileSize = quint64(snapshotFile.size());
+    if (fileSize < sizeof(SnapshotHeader))
+        return false;
+    snapshotData = snapshotFile.map(0, qint64(fileSize));
+    if (snapshotData == nullptr)
+        return false;
+
+    const SnapshotHeader& header = *reinterpret_cast<const SnapshotHeader*>(snapshotData);
+    if (header.magic != OdsSnapshot_MAGIC || header.format != OdsSnapshot_FORMAT || header.version != OdfPreviewLib_VERSION ||
+        header.byteOrder != 0x01020304 || header.styleSize != sizeof(SnapshotStyle) || header.pageStyleSize != sizeof(PageStyle) ||
+        header.rowRunSize != sizeof(RowPos) || header.columnRunSize != sizeof(ColumnPos) || header.pageSize != sizeof(SheetPage))
+        return false;
+
+    for (int i = 0; i < snapshotSectionCount; i++)
+    {
+        const SnapshotSection& section = header.sections[i];
+        if (section.offset % 8 != 0 || section.offset > fileSize || section.size > fileSize - section.offset)
+            return false;
+    }
+    const SnapshotSection* sections = header.sections;
+
+    const QChar* strings = reinterpret_cast<const QChar*>(snapshotData + sections[snapshotStrings].offset);
+    const quint64 stringsSize = sections[snapshotStrings].size / sizeof(QChar);
+
+    QVector<quint32> nameOffsets;
+    fromSnapshot(nameOffsets, snapshotData, sections[snapshotNameOffsets]);
+    const SnapshotStyle* styles = reinterpret_cast<const SnapshotStyle*>(snapshotData + sections[snapshotStyles].offset);
+    const int styleCount = int(sections[snapshotStyles].size / sizeof(SnapshotStyle));
+    if (styleCount == 0 || nameOffsets.count() != styleCount + 1)
+        return false;
+
+    sheet.type = DocType(header.type);
+    sheet.tableStyle = header.tableStyle;
+    for (int i = 0; i < styleCount; i++)
+    {
+        if (nameOffsets.at(i) > nameOffsets.at(i + 1) || nameOffsets.at(i + 1) > stringsSize)
+            return false;
+        const OdsString name = {strings + nameOffsets.at(i), int(nameOffsets.at(i + 1) - nameOffsets.at(i))};
+        sheet.styleNames.append(name);
+        sheet.styleIds.insert(name, quint32(i));
+    }
+
+    contentStyles.resize(styleCount);
+    for (int i = 0; i < styleCount; i++)
+    {
+        const SnapshotStyle& from = styles[i];
+        if (quint64(from.fontName) + from.fontNameSize > stringsSize ||
+            quint64(from.masterPageName) + from.masterPageNameSize > stringsSize)
+            return false;
+
+        CellStyle& style = contentStyles[i];
+        style.type              = StyleFamily(from.type);
+        style.width             = from.width;
+        style.height            = from.height;
+        style.fontName.data     = strings + from.fontName;
+        style.fontName.size     = int(from.fontNameSize);
+        style.fontSize          = from.fontSize;
+        style.align             = Qt::Alignment(from.align);
+        style.backgroundColor   = from.backgroundColor;
+        style.masterPageName.data = strings + from.masterPageName;
+        style.masterPageName.size = int(from.masterPageNameSize);
+        style.breakBefore       = from.breakBefore != 0;
+        fromSnapshot(style.leftBS, from.leftBS);
+        fromSnapshot(style.rightBS, from.rightBS);
+        fromSnapshot(style.topBS, from.topBS);
+        fromSnapshot(style.bottomBS, from.bottomBS);
+    }
+
+    bool lResult =
+        fromSnapshot(sheet.columnStyle, snapshotData, sections[snapshotColumnStyle]) &&
+        fromSnapshot(sheet.columnDefaultCellStyle, snapshotData, sections[snapshotColumnDefaultCellStyle]) &&
+        fromSnapshot(sheet.columnRepeat, snapshotData, sections[snapshotColumnRepeat]) &&
+        fromSnapshot(sheet.rowStyle, snapshotData, sections[snapshotRowStyle]) &&
+        fromSnapshot(sheet.rowRepeat, snapshotData, sections[snapshotRowRepeat]) &&
+        fromSnapshot(sheet.rowFirstCell, snapshotData, sections[snapshotRowFirstCell]) &&
+        fromSnapshot(sheet.cellTextOffset, snapshotData, sections[snapshotCellTextOffset]) &&
+        fromSnapshot(sheet.cellStyle, snapshotData, sections[snapshotCellStyle]) &&
+        fromSnapshot(sheet.cellRowSpan, snapshotData, sections[snapshotCellRowSpan]) &&
+        fromSnapshot(sheet.cellColumnSpan, snapshotData, sections[snapshotCellColumnSpan]) &&
+        fromSnapshot(sheet.cellRepeat, snapshotData, sections[snapshotCellRepeat]) &&
+        fromSnapshot(sheet.cellFlags, snapshotData, sections[snapshotCellFlags]) &&
+        fromSnapshot(rowsPos, snapshotData, sections[snapshotRowRuns]) &&
+        fromSnapshot(columnsPos, snapshotData, sections[snapshotColumnRuns]) &&
+        fromSnapshot(pages, snapshotData, sections[snapshotPages]) &&
+        sections[snapshotPageStyle].size == sizeof(PageStyle);
+    if (!lResult)
+        return false;
+
+    sheet.text = QString::fromRawData(reinterpret_cast<const QChar*>(snapshotData + sections[snapshotText].offset),
+                                      int(sections[snapshotText].size / sizeof(QChar)));
+    memcpy(&sheetPageStyle, snapshotData + sections[snapshotPageStyle].offset, sizeof(PageStyle));
+    usedRowRuns = header.usedRowRuns;
+    usedColumns = header.usedColumns;
+
+    // Opening is O(styles), arrays are never walked. Their lengths are
+    // checked here, style ids, cell ranges and text offsets in them are
+    // clamped where pages are drawn, so a damaged file can't read out of
+    // range of the mapping.
+    const int cells = sheet.cellCount();
+    if (sheet.columnDefaultCellStyle.count() != sheet.columnCount() || sheet.columnRepeat.count() != sheet.columnCount() ||
+        sheet.rowRepeat.count() != sheet.rowCount() || sheet.rowFirstCell.count() != sheet.rowCount() + 1 ||
+        sheet.cellTextOffset.count() != cells + 1 || sheet.cellRowSpan.count() != cells ||
+        sheet.cellColumnSpan.count() != cells || sheet.cellRepeat.count() != cells || sheet.cellFlags.count() != cells ||
+        rowsPos.count() != sheet.rowCount() || columnsPos.count() != sheet.columnCount() ||
+        usedRowRuns < 0 || usedRowRuns > sheet.rowCount() || sheet.tableStyle >= quint32(styleCount))
+        return false;
+
+    cacheStyleObjects();
+    return true;
+}
+
+
+bool OdfPreviewLib::saveSnapshot(const QString fileName) const
+{
+    // Style names come first in the string pool, so that name i is
+    // [nameOffsets[i], nameOffsets[i + 1]). Font and master page names follow.
+    QString             strings;
+    QVector<quint32>    nameOffsets;
+    for (int i = 0; i < sheet.styleNames.count(); i++)
+    {
+        nameOffsets.append(strings.size());
+        strings.append(sheet.styleNames.at(i).data, sheet.styleNames.at(i).size);
+    }
+    nameOffsets.append(strings.size());
+
+    QVector<SnapshotStyle> styles(contentStyles.count());
+    for (int i = 0; i < contentStyles.count(); i++)
+    {
+        const CellStyle& from = contentStyles.at(i);
+        SnapshotStyle& style = styles[i];
+        memset(&style, 0, sizeof(style));
+
+        style.type              = from.type;
+        style.fontSize          = from.fontSize;
+        style.width             = from.width;
+        style.height            = from.height;
+        style.fontName          = strings.size();
+        style.fontNameSize      = from.fontName.size;
+        strings.append(from.fontName.data, from.fontName.size);
+        style.masterPageName    = strings.size();
+        style.masterPageNameSize = from.masterPageName.size;
+        strings.append(from.masterPageName.data, from.masterPageName.size);
+        style.align             = int(from.align);
+        style.backgroundColor   = from.backgroundColor;
+        style.breakBefore       = from.breakBefore;
+        toSnapshot(style.leftBS, from.leftBS);
+        toSnapshot(style.rightBS, from.rightBS);
+        toSnapshot(style.topBS, from.topBS);
+        toSnapshot(style.bottomBS, from.bottomBS);
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic            = OdsSnapshot_MAGIC;
+    header.format           = OdsSnapshot_FORMAT;
+    header.version          = OdfPreviewLib_VERSION;
+    header.byteOrder        = 0x01020304;
+    header.styleSize        = sizeof(SnapshotStyle);
+    header.pageStyleSize    = sizeof(PageStyle);
+    header.rowRunSize       = sizeof(RowPos);
+    header.columnRunSize    = sizeof(ColumnPos);
+    header.pageSize         = sizeof(SheetPage);
+    header.type             = sheet.type;
+    header.tableStyle       = sheet.tableStyle;
+    header.usedRowRuns      = usedRowRuns;
+    header.usedColumns      = usedColumns;
+
+    const void* data[snapshotSectionCount];
+    quint64     size[snapshotSectionCount];
+#define SNAPSHOT_SECTION(id, vector) \
+    data[id] = vector.constData(); size[id] = quint64(vector.count()) * sizeof(vector.at(0))
+    SNAPSHOT_SECTION(snapshotStrings, strings);
+    SNAPSHOT_SECTION(snapshotNameOffsets, nameOffsets);
+    SNAPSHOT_SECTION(snapshotStyles, styles);
+    SNAPSHOT_SECTION(snapshotColumnStyle, sheet.columnStyle);
+    SNAPSHOT_SECTION(snapshotColumnDefaultCellStyle, sheet.columnDefaultCellStyle);
+    SNAPSHOT_SECTION(snapshotColumnRepeat, sheet.columnRepeat);
+    SNAPSHOT_SECTION(snapshotRowStyle, sheet.rowStyle);
+    SNAPSHOT_SECTION(snapshotRowRepeat, sheet.rowRepeat);
+    SNAPSHOT_SECTION(snapshotRowFirstCell, sheet.rowFirstCell);
+    SNAPSHOT_SECTION(snapshotText, sheet.text);
+    SNAPSHOT_SECTION(snapshotCellTextOffset, sheet.cellTextOffset);
+    SNAPSHOT_SECTION(snapshotCellStyle, sheet.cellStyle);
+    SNAPSHOT_SECTION(snapshotCellRowSpan, sheet.cellRowSpan);
+    SNAPSHOT_SECTION(snapshotCellColumnSpan, sheet.cellColumnSpan);
+    SNAPSHOT_SECTION(snapshotCellRepeat, sheet.cellRepeat);
+    SNAPSHOT_SECTION(snapshotCellFlags, sheet.cellFlags);
+    SNAPSHOT_SECTION(snapshotRowRuns, rowsPos);
+    SNAPSHOT_SECTION(snapshotColumnRuns, columnsPos);
+    SNAPSHOT_SECTION(snapshotPages, pages);
+#undef SNAPSHOT_SECTION
+    data[snapshotPageStyle] = &sheetPageStyle;
+    size[snapshotPageStyle] = sizeof(PageStyle);
+
+    // Sections follow the header in order, each aligned to 8 bytes
+    quint64 offset = (sizeof(header) + 7) & ~quint64(7);
+    for (int i = 0; i < snapshotSectionCount; i++)
+    {
+        header.sections[i].offset = offset;
+        header.sections[i].size = size[i];
+        offset = (offset + size[i] + 7) & ~quint64(7);
+    }
+
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    // Written to a temporary file and renamed, readers never see a partial one
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    bool lResult = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == qint64(sizeof(header));
+    const char padding[8] = {0};
+    for (int i = 0; i < snapshotSectionCount && lResult; i++)
+    {
+        const qint64 gap = qint64(header.sections[i].offset) - file.pos();
+        lResult = file.write(padding, gap) == gap &&
+                  file.write(static_cast<const char*>(data[i]), qint64(size[i])) == qint64(size[i]);
+    }
+
+    if (!lResult)
+    {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+
+void OdfPreviewLib::startLoader(const QString& fileName)
+{
+    loadTask = QFutureInterface<bool>();
+    loadTask.reportStarted();
+
+    loader = new OdfPreviewLib();
+    loader->publishTarget = this;
+    loader->stylesLoading = stylesLoading;
+    loader->loadingStyles = loadingStyles;
+    loadingContent = true;
+    loading = QtConcurrent::run(loader, &OdfPreviewLib::loadProgressive, fileName);
+}
+
+
+bool OdfPreviewLib::isLoading() const
+{
+    return loadingContent;
+}
+
+
 bool OdfPreviewLib::open(const QDomDocument* const doc)
 {
-    content = *doc;
+    close();
+
+    QByteArray data = doc->toByteArray();
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::ReadOnly);
+
+    if (!loadContent(&buffer))
+        return false;
+
+    resolvePageStyle();
+    paginate();
     return true;
 }
 
 
 DocType OdfPreviewLib::getDocType() const
 {
-    DocType result = none;
+    return sheet.type;
+}
 
-    if (content.elementsByTagName("office:spreadsheet").count() > 0)
-        result = ods;
-    else if (content.elementsByTagName("office:text").count() > 0)
-        result = odt;
 
-    return result;
+void OdfPreviewLib::close()
+{
+    // A progressive load still running is stopped at its next row, and a
+    // snapshot it has handed over but not applied yet is dropped
+    if (loader != nullptr)
+    {
+        loader->cancelLoad.storeRelease(1);
+        loading.waitForFinished();
+    }
+    if (loadingStyles)
+    {
+        stylesLoading.waitForFinished();
+        loadingStyles = false;
+    }
+    loadedMutex.lock();
+    loadedPending = false;
+    loadedSheet = SheetModel();
+    loadedStyles.clear();
+    loadedMutex.unlock();
+    loadingContent = false;
+
+    // Styles and layout belong to the opened document only. Containers are
+    // emptied but keep their capacity, so an instance reused for many
+    // documents stops allocating for them once it has seen a large one.
+    resetSheet();
+    contentStyles.resize(0);
+    clearKeepingCapacity(pageStyles);
+    clearKeepingCapacity(sheetPrintStyleNames);
+    sheetPageStyle = PageStyle();
+    rowsPos.resize(0);
+    usedRowRuns = 0;
+    columnsPos.resize(0);
+    usedColumns = 0;
+    pages.resize(0);
+    fonts.resize(0);
+    borderPens.resize(0);
+    pageImages.clear();
+
+    // Strings of the styles applied from a loader live in its arena
+    delete loader;
+    loader = nullptr;
+
+    // and those of an opened snapshot in its mapping
+    if (snapshotData != nullptr)
+        snapshotFile.unmap(snapshotData);
+    snapshotData = nullptr;
+    snapshotFile.close();
 }
 
 
-void OdfPreviewLib::close()
+int OdfPreviewLib::styleLoadCount() const
+{
+    return styleLoads.loadAcquire();
+}
+
+
+int OdfPreviewLib::pageCount() const
+{
+    switch (getDocType())
+    {
+        case ods:
+            return pages.count();
+        case odt:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+
+QSizeF OdfPreviewLib::pageSize() const
 {
+    return QSizeF(sheetPageStyle.width > 0 ? sheetPageStyle.width : 210,
+                  sheetPageStyle.height > 0 ? sheetPageStyle.height : 297);
 }
 
 
 void OdfPreviewLib::preview()
 {
+    if (printPreview == nullptr)
+    {
+        createPrinter();
+        printPreview = new QPrintPreviewDialog(printer, parentWidget);
+
+        printPreview->setWindowTitle("Preview Dialog");
+        Qt::WindowFlags flags(Qt::WindowTitleHint);
+        printPreview->setWindowFlags(flags);
+
+        connect(printPreview, SIGNAL(paintRequested(QPrinter*)), this, SLOT(draw(QPrinter*)));
+    }
+
     setPrinterConfig();
     printPreview->exec();
 }
 
 
-void OdfPreviewLib::print()
+void OdfPreviewLib::print()
+{
+    createPrinter();
+    setPrinterConfig();
+
+    // Printed pages are never taken from the preview cache
+    render(printer, printer->fromPage() - 1, printer->toPage() - 1);
+}
+
+
+bool OdfPreviewLib::render(QPagedPaintDevice* device, int firstPage, int lastPage)
+{
+    QPainter painter;
+    if (!painter.begin(device))
+        return false;
+
+    painter.setRenderHints(QPainter::Antialiasing |
+                       QPainter::TextAntialiasing |
+                       QPainter::SmoothPixmapTransform, true);
+
+    firstPage = qMax(firstPage, 0);
+    if (lastPage < 0 || lastPage >= pageCount())
+        lastPage = pageCount() - 1;
+
+    if (rasterDpi > 0)
+        paintImages(painter, device, firstPage, lastPage, rasterDpi, false, false);
+    else
+    {
+        for (int page = firstPage; page <= lastPage; page++)
+        {
+            if (page > firstPage)
+                device->newPage();
+            renderPage(&painter, page);
+        }
+    }
+
+    return painter.end();
+}
+
+
+void OdfPreviewLib::renderPage(QPainter* painter, int page, bool draft) const
+{
+    if (page < 0 || page >= pageCount())
+        return;
+
+    // Sizes are converted with the resolution of the device being painted
+    PaintContext context;
+    context.painter     = painter;
+    context.resolution  = painter->device()->logicalDpiY();
+    context.fontId      = -1;
+    context.draft       = draft;
+
+    switch (getDocType())
+    {
+        case ods:
+            drawOdsPage(context, page);
+            break;
+        case odt:
+            drawOdt(context);
+            break;
+        default:
+            break;
+    }
+}
+
+
+QImage OdfPreviewLib::renderToImage(int page, int dpi, bool draft) const
+{
+    const QSizeF size = pageSize();
+
+    QImage image(qCeil(size.width() * dpi / 25.4), qCeil(size.height() * dpi / 25.4), QImage::Format_ARGB32_Premultiplied);
+    image.setDotsPerMeterX(qRound(dpi / 0.0254));
+    image.setDotsPerMeterY(qRound(dpi / 0.0254));
+    image.fill(Qt::white);
+
+    QPainter painter(&image);
+    painter.setRenderHints(QPainter::Antialiasing |
+                       QPainter::TextAntialiasing |
+                       QPainter::SmoothPixmapTransform, !draft);
+    renderPage(&painter, page, draft);
+
+    return image;
+}
+
+
+// Renders one page of the document, used as a QtConcurrent map functor
+struct PageRenderer
+{
+    typedef QImage result_type;
+
+    const OdfPreviewLib*    doc;
+    int                     dpi;
+    bool                    draft;
+
+    QImage operator()(int page) const
+    {
+        return doc->renderToImage(page, dpi, draft);
+    }
+};
+
+
+QVector<QImage> OdfPreviewLib::renderToImages(int dpi, int firstPage, int lastPage) const
+{
+    firstPage = qMax(firstPage, 0);
+    if (lastPage < 0 || lastPage >= pageCount())
+        lastPage = pageCount() - 1;
+
+    QVector<int> pageNumbers;
+    for (int page = firstPage; page <= lastPage; page++)
+        pageNumbers.append(page);
+
+    return renderToImages(dpi, pageNumbers, false);
+}
+
+
+QVector<QImage> OdfPreviewLib::renderToImages(int dpi, const QVector<int>& pageNumbers, bool draft) const
+{
+    PageRenderer renderer;
+    renderer.doc = this;
+    renderer.dpi = dpi;
+    renderer.draft = draft;
+
+    return QtConcurrent::blockingMapped<QVector<QImage> >(pageNumbers, renderer);
+}
+
+
+QImage OdfPreviewLib::thumbnail(const QString& fileName, int fallbackDpi)
+{
+    QImage lResult;
+
+    QuaZip zip(fileName);
+    if (zip.open(QuaZip::mdUnzip) && zip.setCurrentFile("Thumbnails/thumbnail.png"))
+    {
+        QuaZipFile file(&zip);
+        if (file.open(QIODevice::ReadOnly))
+        {
+            // PNG data is compressed already, packages usually store it
+            QByteArray data = file.mapStored();
+            if (data.isNull())
+                data = file.readAll();
+            lResult = QImage::fromData(data, "PNG");
+            file.close();
+        }
+    }
+    zip.close();
+
+    if (lResult.isNull())
+    {
+        OdfPreviewLib doc;
+        if (doc.open(fileName))
+            lResult = doc.renderToImage(0, fallbackDpi, true);
+    }
+
+    return lResult;
+}
+
+
+void OdfPreviewLib::setParallelRendering(int dpi)
+{
+    rasterDpi = qMax(dpi, 0);
+}
+
+
+bool OdfPreviewLib::renderToPdf(const QString& fileName)
+{
+    QPdfWriter writer(fileName);
+    writer.setPageSize(QPageSize(pageSize(), QPageSize::Millimeter));
+    writer.setPageMargins(QMarginsF(0, 0, 0, 0));
+
+    return render(&writer);
+}
+
+
+void OdfPreviewLib::setPageCacheSize(int kilobytes)
+{
+    pageImages.setMaxCost(qMax(kilobytes, 0));
+}
+
+
+void OdfPreviewLib::setDraftPreview(int dpi)
+{
+    draftDpi = qMax(dpi, 0);
+}
+
+
+void OdfPreviewLib::draw(QPrinter *printer)
+{
+    // The dialog generates its preview pages through a picture engine, its
+    // print and PDF export actions emit the same signal with the engine of
+    // the printer. Only preview pages are taken from the cache or drafted,
+    // draft pages are always rasterized, whether the cache keeps them or not.
+    // Page range is 1-based, 0 means all pages.
+    const bool previewing = printer->paintEngine() != nullptr && printer->paintEngine()->type() == QPaintEngine::Picture;
+    const bool draft = previewing && draftDpi > 0;
+    if (draft || (previewing && pageImages.maxCost() > 0))
+        renderCached(printer, printer->fromPage() - 1, printer->toPage() - 1, draft);
+    else
+        render(printer, printer->fromPage() - 1, printer->toPage() - 1);
+}
+
+
+static quint64 pageImageKey(int page, int dpi, bool draft)
+{
+    return (quint64(draft) << 63) | (quint64(dpi) << 32) | quint32(page);
+}
+
+
+bool OdfPreviewLib::renderCached(QPagedPaintDevice* device, int firstPage, int lastPage, bool draft)
+{
+    QPainter painter;
+    if (!painter.begin(device))
+        return false;
+
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, !draft);
+
+    firstPage = qMax(firstPage, 0);
+    if (lastPage < 0 || lastPage >= pageCount())
+        lastPage = pageCount() - 1;
+
+    const qreal resolution = device->logicalDpiY();
+    int dpi = (qCeil(resolution) + 31) / 32 * 32;
+    if (draft)
+        dpi = qMin(dpi, draftDpi);
+
+    paintImages(painter, device, firstPage, lastPage, dpi, draft, true);
+
+    return painter.end();
+}
+
+
+// Pages are independent, they are rendered concurrently in windows of one
+// page per pool thread and painted in order. Images not kept by the cache
+// are freed with their window, so memory doesn't grow with the page count.
+// Images are shared, so pages of a window are taken from the cache up front
+// and inserting new pages can't drop any of them before they are painted.
+void OdfPreviewLib::paintImages(QPainter& painter, QPagedPaintDevice* device, int firstPage, int lastPage,
+                                int dpi, bool draft, bool cached)
+{
+    const qreal resolution = device->logicalDpiY();
+    const QRectF target(0, 0, mmToPixels(pageSize().width(), resolution), mmToPixels(pageSize().height(), resolution));
+
+    const int window = qMax(QThreadPool::globalInstance()->maxThreadCount(), 1);
+    for (int first = firstPage; first <= lastPage; first += window)
+    {
+        const int last = qMin(first + window - 1, lastPage);
+
+        QVector<QImage>     images(last - first + 1);
+        QVector<int>        missing;
+        for (int page = first; page <= last; page++)
+        {
+            const QImage* image = cached ? pageImages.object(pageImageKey(page, dpi, draft)) : nullptr;
+            if (image != nullptr)
+                images[page - first] = *image;
+            else
+                missing.append(page);
+        }
+
+        if (!missing.isEmpty())
+        {
+            const QVector<QImage> rendered = renderToImages(dpi, missing, draft);
+            for (int i = 0; i < missing.count(); i++)
+            {
+                const QImage& image = rendered.at(i);
+                images[missing.at(i) - first] = image;
+                if (cached && pageImages.maxCost() > 0)
+                    pageImages.insert(pageImageKey(missing.at(i), dpi, draft), new QImage(image),
+                                      qMax(image.bytesPerLine() * image.height() / 1024, 1));
+            }
+        }
+
+        for (int i = 0; i < images.count(); i++)
+        {
+            if (first + i > firstPage)
+                device->newPage();
+            painter.drawImage(target, images.at(i));
+        }
+    }
+}
+
+
+bool OdfPreviewLib::unzip(QString fileName)
+{
+    // styles.xml is independent of content.xml and only fills the page style
+    // tables, so it is inflated and parsed from its own archive handle while
+    // content.xml is loaded here
+    QFuture<bool> styles = QtConcurrent::run(this, &OdfPreviewLib::unzipStyles, fileName);
+
+    bool lResult = unzipContent(fileName);
+
+    if (!styles.result())
+        lResult = false;
+
+    if (lResult)
+    {
+        resolvePageStyle();
+        paginate();
+    }
+
+    return lResult;
+}
+
+
+bool OdfPreviewLib::unzipContent(QString fileName)
+{
+    bool lResult = false;
+
+    QuaZip zip(fileName);
+    zip.open(QuaZip::mdUnzip);
+
+    if (zip.setCurrentFile("content.xml"))
+    {
+        QuaZipFile file(&zip);
+        file.open(QIODevice::ReadOnly);
+
+        // Progress of a load is counted in bytes of content.xml
+        QuaZipFileInfo64 info;
+        if (publishTarget != nullptr && file.getFileInfo(&info))
+            publishTarget->loadTask.setProgressRange(0, int(qMin(qint64(info.uncompressedSize), qint64(INT_MAX))));
+
+        // A stored content.xml is parsed in place from the mapped archive.
+        // A compressed one is inflated on another thread into a bounded
+        // ring of chunks, which is tokenized while inflating goes on.
+        QByteArray mapped = file.mapStored();
+        if (!mapped.isNull())
+        {
+            QBuffer buffer(&mapped);
+            buffer.open(QIODevice::ReadOnly);
+            lResult = loadContent(&buffer);
+        }
+        else
+        {
+            OdsInflatePipe pipe(fileName, "content.xml");
+            pipe.open(QIODevice::ReadOnly);
+            lResult = loadContent(&pipe) && !pipe.failed();
+            pipe.close();
+        }
+
+        file.close();
+    }
+    zip.close();
+
+    return lResult;
+}
+
+
+bool OdfPreviewLib::unzipStyles(QString fileName)
+{
+    bool lResult = false;
+
+    QuaZip zip(fileName);
+    zip.open(QuaZip::mdUnzip);
+
+    if (zip.setCurrentFile("styles.xml"))
+    {
+        QuaZipFile file(&zip);
+        file.open(QIODevice::ReadOnly);
+
+        QByteArray data = file.mapStored();
+        if (data.isNull())
+            data = file.readAll();
+
+        // styles.xml is only needed while page styles are loaded
+        QDomDocument styles;
+        if (styles.setContent(data))
+        {
+            loadPageStyles(styles);
+            lResult = true;
+        }
+
+        file.close();
+    }
+    zip.close();
+
+    return lResult;
+}
+
+
+// Runs on a worker thread in the loader instance of openProgressive()
+bool OdfPreviewLib::loadProgressive(QString fileName)
+{
+    nextPublish = 64;
+    bool lResult = unzipContent(fileName);
+
+    // The result of openAsync() includes its page styles
+    if (lResult && loadingStyles)
+        lResult = stylesLoading.result();
+    publishSheet(true, lResult);
+
+    // The future is finished here, not by applyLoadedSheet(), so it can be
+    // waited on from any thread, including the one applying the document
+    QFutureInterface<bool>& task = publishTarget->loadTask;
+    if (lResult)
+        task.setProgressValue(task.progressMaximum());
+    else if (loadCanceled())
+        task.reportCanceled();
+    task.reportResult(lResult);
+    task.reportFinished();
+
+    return lResult;
+}
+
+
+bool OdfPreviewLib::loadCanceled() const
 {
-    setPrinterConfig();
+    return cancelLoad.loadAcquire() != 0 || (publishTarget != nullptr && publishTarget->loadTask.isCanceled());
 }
 
 
-void OdfPreviewLib::draw(QPrinter *printer)
+// Hands the rows parsed so far over to the instance being loaded
+void OdfPreviewLib::publishSheet(bool finished, bool ok)
 {
-    QPainter painter(printer);
-    painter.setRenderHints(QPainter::Antialiasing |
-                       QPainter::TextAntialiasing |
-                       QPainter::SmoothPixmapTransform, true);
+    SheetModel          model;
+    QVector<CellStyle>  styles;
 
-    switch (getDocType())
+    if (ok)
     {
-        case ods:
-            drawOds(&painter);
-            break;
-        case odt:
-            drawOdt(&painter);
-            break;
-        default:
-            break;
+        // Arrays are shared, the loader detaches them with its next append
+        model = sheet;
+        styles = contentStyles;
+        styles.resize(sheet.styleNames.count());
+
+        if (!finished)
+        {
+            // Close ranges of the last parsed row and cell
+            model.rowFirstCell.append(model.cellCount());
+            model.cellTextOffset.append(model.text.size());
+        }
     }
+
+    publishTarget->receiveSheet(model, styles, finished, ok);
 }
 
 
-bool OdfPreviewLib::unzip(QString fileName)
+// Called from the loader thread, only the latest snapshot is applied
+void OdfPreviewLib::receiveSheet(const SheetModel& model, const QVector<CellStyle>& styles, bool finished, bool ok)
 {
-    bool lResult = false;
+    QMutexLocker locker(&loadedMutex);
 
-    QuaZip zip(fileName);
-    zip.open(QuaZip::mdUnzip);
+    const bool queued = loadedPending;
+    loadedSheet     = model;
+    loadedStyles    = styles;
+    loadedPending   = true;
+    loadedFinished  = finished;
+    loadedOk        = ok;
 
-    if (zip.setCurrentFile("content.xml"))
-    {
-        QuaZipFile file(&zip);
-        file.open(QIODevice::ReadOnly);
+    if (!queued)
+        QMetaObject::invokeMethod(this, "applyLoadedSheet", Qt::QueuedConnection);
+}
 
-        QByteArray data(file.size(), ' ');
-        file.read(data.data(), file.size());
 
-        if (content.setContent(data))
-            lResult = true;
+void OdfPreviewLib::applyLoadedSheet()
+{
+    QMutexLocker locker(&loadedMutex);
 
-        file.close();
+    // close() drops snapshots of a load it has stopped
+    if (!loadedPending)
+        return;
+
+    bool finished   = loadedFinished;
+    bool ok         = loadedOk && loadingContent;
+    if (ok)
+    {
+        sheet = loadedSheet;
+        contentStyles = loadedStyles;
     }
+    loadedSheet = SheetModel();
+    loadedStyles.clear();
+    loadedPending = false;
+    locker.unlock();
 
-    if (lResult)
+    // A load that failed already reports nothing more
+    if (!loadingContent)
+        return;
+
+    // Pages can't be laid out before the page styles of openAsync() are known
+    if (ok && loadingStyles)
     {
-        lResult = false;
-        if (zip.setCurrentFile("styles.xml"))
+        loadingStyles = false;
+        if (!stylesLoading.result())
         {
-            QuaZipFile file(&zip);
-            file.open(QIODevice::ReadOnly);
+            loader->cancelLoad.storeRelease(1);
+            finished = true;
+            ok = false;
+        }
+    }
 
-            QByteArray data(file.size(), ' ');
-            file.read(data.data(), file.size());
+    const int pagesBefore = pages.count();
+    if (ok)
+    {
+        pageImages.clear();
+        cacheStyleObjects();
+        layoutSheet();
+        resolvePageStyle();
+        paginate();
+    }
+    else if (finished)
+    {
+        // Rows shown so far are dropped, a failed or cancelled load leaves
+        // no document, like a failed open()
+        resetSheet();
+        contentStyles.resize(0);
+        rowsPos.resize(0);
+        usedRowRuns = 0;
+        columnsPos.resize(0);
+        usedColumns = 0;
+        pages.resize(0);
+        fonts.resize(0);
+        borderPens.resize(0);
+        pageImages.clear();
+    }
+    if (finished)
+        loadingContent = false;
 
-            if (styles.setContent(data))
-                lResult = true;
+    if (pages.count() != pagesBefore)
+        emit pagesAvailable(pages.count());
 
-            file.close();
-        }
+    if (printPreview != nullptr && printPreview->isVisible())
+    {
+        QPrintPreviewWidget* widget = printPreview->findChild<QPrintPreviewWidget*>();
+        if (widget != nullptr)
+            widget->updatePreview();
     }
-    zip.close();
 
-    return lResult;
+    if (finished)
+        emit loadFinished(ok);
+}
+
+
+void OdfPreviewLib::createPrinter()
+{
+    if (printer == nullptr)
+        printer = new QPrinter();
 }
 
 
@@ -155,167 +1131,297 @@ void OdfPreviewLib::setPrinterConfig()
 }
 
 
-void OdfPreviewLib::drawOds(QPainter* painter)
+// Splits the used area of the sheet into bands of rows and columns fitting on
+// a page and builds the page table from them. Rows and columns are never cut
+// by the page edge, rows of a run fitting on a page are found arithmetically,
+// so long runs cost O(pages).
+void OdfPreviewLib::paginate()
 {
-    loadPageStyles();
-    loadContentStyles();
+    pages.resize(0);
 
-    // Calculate row's vertical position and height
-    QDomNodeList    rows = content.elementsByTagName("table:table-row");
-    qreal   y = 0;
-    for (int i = 0; i < rows.count(); i++)
+    const qreal printableHeight = sheetPageStyle.height - sheetPageStyle.marginTop - sheetPageStyle.marginBottom;
+    const qreal printableWidth  = sheetPageStyle.width - sheetPageStyle.marginLeft - sheetPageStyle.marginRight;
+
+    QVector<PageBand> rowBands;
+    PageBand band = {0, 0, 0};
+    for (int r = 0; r < usedRowRuns; r++)
+    {
+        const RowPos& run = rowsPos.at(r);
+        paginateRun(rowBands, band, run.y, run.h, run.first, run.count,
+                    styleOf(sheet.rowStyle.at(r)).breakBefore, printableHeight);
+    }
+    if (band.last > band.first)
+        rowBands.append(band);
+
+    QVector<PageBand> columnBands;
+    band.first = band.last = 0;
+    band.offset = 0;
+    for (int i = 0; i < columnsPos.count() && columnsPos.at(i).first < usedColumns; i++)
     {
-        RowPos pos;
+        const ColumnPos& run = columnsPos.at(i);
+        paginateRun(columnBands, band, run.x, run.w, run.first, qMin(run.count, usedColumns - run.first),
+                    styleOf(sheet.columnStyle.at(i)).breakBefore, printableWidth);
+    }
+    if (band.last > band.first)
+        columnBands.append(band);
 
-        pos.y = y;
-        pos.h = contentStyles[rows.at(i).toElement().attribute("table:style-name")].height;
+    // Cells past the last column run have no width, keep them on the last column band
+    if (columnBands.isEmpty() && usedColumns > 0)
+        columnBands.append(PageBand{0, usedColumns, 0});
+    else if (!columnBands.isEmpty())
+        columnBands.last().last = qMax(columnBands.last().last, usedColumns);
 
-        rowsPos.insert(i, pos);
-        y += pos.h;
+    if (sheetPageStyle.leftToRight)
+    {
+        for (int r = 0; r < rowBands.count(); r++)
+            for (int c = 0; c < columnBands.count(); c++)
+                pages.append(SheetPage{rowBands.at(r), columnBands.at(c)});
+    }
+    else
+    {
+        for (int c = 0; c < columnBands.count(); c++)
+            for (int r = 0; r < rowBands.count(); r++)
+                pages.append(SheetPage{rowBands.at(r), columnBands.at(c)});
     }
+}
 
-    // Calculate column's horizontal position and width
-    QDomNodeList    columns = content.elementsByTagName("table:table-column");
-    qreal   x = 0;
-    for (int i = 0; i < columns.count(); i++)
+
+// Adds count rows (or columns) of the given size starting at offset to the current band
+void OdfPreviewLib::paginateRun(QVector<PageBand>& bands, PageBand& band, qreal offset, qreal size,
+                                quint32 first, quint32 count, bool breakBefore, qreal extent) const
+{
+    quint32 k = 0;
+    while (k < count)
     {
-        ColumnPos pos;
+        const qreal pos = offset + k * size;
+
+        // If end of printable area reached or page break is set, start new band
+        if (band.last > band.first && (breakBefore || pos + size > band.offset + extent))
+        {
+            bands.append(band);
+            band.first  = first + k;
+            band.offset = pos;
+        }
+        else if (band.last == band.first)
+        {
+            band.first  = first + k;
+            band.offset = pos;
+        }
 
-        pos.x = x;
-        pos.w = contentStyles[columns.at(i).toElement().attribute("table:style-name")].width;
+        // Rows of the run which fit on the current band
+        quint32 n = count - k;
+        if (breakBefore)
+            n = 1;
+        else if (size > 0)
+        {
+            const int fit = qMax(qFloor((band.offset + extent - pos) / size), 1);
+            n = qMin(quint32(fit), n);
+        }
 
-        columnsPos.insert(i, pos);
-        x += pos.w;
+        k += n;
+        band.last = first + k;
     }
+}
 
-    QString pageStyleName = content.elementsByTagName("table:table").at(0).toElement().attribute("table:style-name");
-    pageStyleName = firstNodeWithAttribute(content.elementsByTagName("style:style"), "style:name", pageStyleName).toElement().attribute("style:master-page-name");
-    pageStyleName = sheetPrintStyleNames.value(pageStyleName);
 
-    // Calculate cell's positions
+// Draws rows of the page only, the first row run is found by binary search
+void OdfPreviewLib::drawOdsPage(PaintContext& context, int page) const
+{
+    const SheetPage& sp = pages.at(page);
 
-    qreal leftMargin = pageStyles[pageStyleName].marginLeft;
-//    qreal rightMargin = pageStyles[pageStyleName].marginRight;
-    qreal topMargin = pageStyles[pageStyleName].marginTop;
-    qreal bottomMargin = pageStyles[pageStyleName].marginBottom;
-    qreal printablePageHeight = pageStyles[pageStyleName].height - topMargin - bottomMargin;
-    int     pageCounter = 1;
+    const RowPos* it = std::upper_bound(rowsPos.constBegin(), rowsPos.constEnd(), sp.rows.first,
+                                                          [](quint32 r, const RowPos& pos) { return r < pos.first; });
+    if (it != rowsPos.constBegin())
+        --it;
 
-    qreal rowY = 0;
-    qreal rowH = 0;
+    BorderBatch borders;
 
-    rows = content.elementsByTagName("table:table-row");
-    for (int i = 0; i < rows.count(); i++)
+    for (int r = it - rowsPos.constBegin(); r < usedRowRuns && rowsPos.at(r).first < sp.rows.last; r++)
     {
-        qreal colX = 0;
-        qreal colW = 0;
+        const RowPos& run = rowsPos.at(r);
+        if (!run.visible)
+            continue;
+
+        const quint32 first = qMax(run.first, sp.rows.first);
+        const quint32 last  = qMin(run.first + run.count, sp.rows.last);
+        for (quint32 row = first; row < last; row++)
+        {
+            const qreal rowY = run.y + (row - run.first) * run.h;
+            drawOdsRow(context, r, row, rowY - sp.rows.offset + sheetPageStyle.marginTop, sp, borders);
+        }
+    }
 
-        QString text;
-        QString styleName;
-        int repeate = 0;
+    drawBorders(context, borders);
+}
+
+
+void OdfPreviewLib::drawOdsRow(PaintContext& context, int run, quint32 row, qreal top, const SheetPage& page, BorderBatch& borders) const
+{
+    QPainter* painter = context.painter;
+    quint32 column = 0;     // first column of the cell
+    const quint32 lastColumn = qMin(usedColumns, page.columns.last);
+    const qreal left = sheetPageStyle.marginLeft - page.columns.offset;
+
+    // Ranges are clamped, those of a mapped snapshot are not checked on opening
+    const quint32 cellEnd = qMin(sheet.rowFirstCell.at(run + 1), quint32(sheet.cellCount()));
+    for (quint32 c = sheet.rowFirstCell.at(run); c < cellEnd && column < lastColumn; c++)
+    {
+        const quint32 repeat = qMax(sheet.cellRepeat.at(c), quint32(1));
 
-        QDomNodeList cells = rows.at(i).childNodes();
-        for (int j = 0; j < cells.count(); j++)
+        if (column + repeat > page.columns.first && visibleCellEnd(c, column) > 0)
         {
-            if (cells.at(j).nodeName() != "table:covered-table-cell")
-            {
-                if (repeate == 0)
-                {
-                    repeate = QString(cells.at(j).toElement().attribute("table:number-columns-repeated")).toInt();
-                    text = cells.at(j).firstChildElement("text:p").text();
-                    styleName = cells.at(j).toElement().attribute("table:style-name");
-                    if (styleName.size() == 0)
-                        styleName = columns.at(j).toElement().attribute("table:default-cell-style-name");
-                }
-                else
-                    --repeate;
+            const quint32 textEnd = qMin(sheet.cellTextOffset.at(c + 1), quint32(sheet.text.size()));
+            const quint32 textBegin = qMin(sheet.cellTextOffset.at(c), textEnd);
+            const QString text = QString::fromRawData(sheet.text.constData() + textBegin, int(textEnd - textBegin));
 
-                int rowSpanned = QString(cells.at(j).toElement().attribute("table:number-rows-spanned")).toInt();
-                int colSpanned = QString(cells.at(j).toElement().attribute("table:number-columns-spanned")).toInt();
+            const quint32 rowSpanned = qMax(sheet.cellRowSpan.at(c), quint32(1));
+            const quint32 colSpanned = qMax(sheet.cellColumnSpan.at(c), quint32(1));
 
-                rowY = rowsPos[i].y;
-                if (rowSpanned > 1)
-                {
-                    for (int s = 0; s < rowSpanned; s++)
-                        rowH += rowsPos[i+s].h;
-                }
-                else
-                    rowH = rowsPos[i].h;
+            // Computed like the top of the row below, so both give the same pixel
+            const qreal bottom = rowOffset(row + rowSpanned) - page.rows.offset + sheetPageStyle.marginTop;
 
-                colX = columnsPos[j].x;
-                if (colSpanned > 1)
+            // Repeated cells are expanded here, columns are never materialized
+            const quint32 last = qMin(column + repeat, lastColumn);
+            for (quint32 col = qMax(column, page.columns.first); col < last; col++)
+            {
+                quint32 cellStyleId = sheet.cellStyle.at(c);
+                if (cellStyleId == 0)
                 {
-                    for (int s = 0; s < colSpanned; s++)
-                        colW += columnsPos[j+s].w;
+                    const int i = columnRun(col);
+                    if (i < sheet.columnCount())
+                        cellStyleId = sheet.columnDefaultCellStyle.at(i);
                 }
-                else
-                    colW = columnsPos[j].w;
+                const CellStyle& style = styleOf(cellStyleId);
 
-                // If end of printable area reached, add new page
-                if ((rowY + rowH) >= pageCounter * printablePageHeight)
-                {
-                    printer->newPage();
-                    pageCounter++;
-                }
+                if (text.isEmpty() && !isVisible(style))
+                    continue;
 
-                int x = mmToPixels(colX + leftMargin);
-                int y = mmToPixels(rowY - (pageCounter - 1) * printablePageHeight + topMargin );
-                int w = mmToPixels(colW);
-                int h = mmToPixels(rowH);
+                // All edges are converted from absolute positions, the right
+                // and bottom edges of a cell are then exactly the left and top
+                // edges of its neighbours and shared borders are merged
+                const int x = mmToPixels(columnOffset(col) + left, context.resolution);
+                const int y = mmToPixels(top, context.resolution);
+                const int w = int(mmToPixels(columnOffset(col + colSpanned) + left, context.resolution)) - x;
+                const int h = int(mmToPixels(bottom, context.resolution)) - y;
 
                 // Draw text
 
                 QRect rect(x, y, w, h);
-                QTextOption textOption;
-
-                if (contentStyles[styleName].backgroundColor.size() > 0)
-                    painter->fillRect(rect, QBrush(QColor(contentStyles[styleName].backgroundColor)));
-
-                textOption.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
-                textOption.setAlignment(contentStyles[styleName].align);
-                painter->setFont(QFont(contentStyles[styleName].fontName, contentStyles[styleName].fontSize));
-                painter->drawText(rect, text, textOption);
-
-                // Draw borders
-                if (contentStyles[styleName].leftBS.size > 0)
-                    painter->drawLine(x, y, x, y + h);
-                if (contentStyles[styleName].rightBS.size > 0)
-                    painter->drawLine(x + w, y, x + w, y + h);
-                if (contentStyles[styleName].topBS.size > 0)
-                    painter->drawLine(x, y, x + w, y);
-                if (contentStyles[styleName].bottomBS.size > 0)
-                    painter->drawLine(x, y + h, x + w, y + h);
+
+                if (qAlpha(style.backgroundColor) > 0)
+                    painter->fillRect(rect, QColor::fromRgba(style.backgroundColor));
+
+                if (!text.isEmpty())
+                {
+                    if (style.fontId != context.fontId)
+                    {
+                        painter->setFont(fonts.at(style.fontId));
+                        context.fontId = style.fontId;
+                    }
+                    // Wrapping is the most expensive part of drawing text
+                    if (context.draft)
+                        painter->drawText(rect, int(style.align) | Qt::TextSingleLine,
+                                          painter->fontMetrics().elidedText(text, Qt::ElideRight, w));
+                    else
+                        painter->drawText(rect, text, style.textOption);
+                }
+
+                // Borders are drawn for the whole page at once
+                if (style.leftBS.penId >= 0)
+                    addBorder(borders, BorderEdge{x, y, x, y + h}, style.leftBS.penId);
+                if (style.rightBS.penId >= 0)
+                    addBorder(borders, BorderEdge{x + w, y, x + w, y + h}, style.rightBS.penId);
+                if (style.topBS.penId >= 0)
+                    addBorder(borders, BorderEdge{x, y, x + w, y}, style.topBS.penId);
+                if (style.bottomBS.penId >= 0)
+                    addBorder(borders, BorderEdge{x, y + h, x + w, y + h}, style.bottomBS.penId);
             }
         }
+        column += repeat;
+    }
+}
+
+
+// Adds the edge once, the wider pen wins on edges shared by adjacent cells
+void OdfPreviewLib::addBorder(BorderBatch& borders, const BorderEdge& edge, int penId) const
+{
+    QHash<BorderEdge, int>::const_iterator it = borders.index.constFind(edge);
+    if (it == borders.index.constEnd())
+    {
+        borders.index.insert(edge, borders.edges.count());
+        borders.edges.append(edge);
+        borders.penIds.append(penId);
+    }
+    else if (borderPens.at(penId).widthF() > borderPens.at(borders.penIds.at(it.value())).widthF())
+        borders.penIds[it.value()] = penId;
+}
+
+
+// Emits one drawLines() call per pen
+void OdfPreviewLib::drawBorders(PaintContext& context, const BorderBatch& borders) const
+{
+    QPainter* painter = context.painter;
+
+    QVector<QVector<QLineF> > lines(borderPens.count());
+    for (int i = 0; i < borders.edges.count(); i++)
+    {
+        const BorderEdge& e = borders.edges.at(i);
+        lines[borders.penIds.at(i)].append(QLineF(e.x1, e.y1, e.x2, e.y2));
+    }
+
+    const QPen textPen = painter->pen();
+    const qreal pointToPixels = context.resolution / 72.0;
+
+    for (int i = 0; i < lines.count(); i++)
+    {
+        if (lines.at(i).isEmpty())
+            continue;
+
+        QPen pen = borderPens.at(i);
+        pen.setWidthF(pen.widthF() * pointToPixels);
+        painter->setPen(pen);
+        painter->drawLines(lines.at(i));
     }
+
+    painter->setPen(textPen);
 }
 
 
-void OdfPreviewLib::drawOdt(QPainter* painter)
+void OdfPreviewLib::drawOdt(PaintContext& context) const
 {
-    painter->setFont(QFont("Tahoma",8));
-    painter->drawText(100, 100, "It's the text!");
+    context.painter->setFont(QFont("Tahoma",8));
+    context.painter->drawText(100, 100, "It's the text!");
 }
 
 
-qreal OdfPreviewLib::mmToPixels(qreal mm) const
+qreal OdfPreviewLib::mmToPixels(qreal mm, qreal resolution) const
 {
-    return mm * 0.039370147 * printer->resolution();
+    return mm * 0.039370147 * resolution;
 }
 
 
-BorderStyle OdfPreviewLib::parseBorderTypeString(const QString str, const BorderStyle* const defaultBS) const
+BorderStyle OdfPreviewLib::parseBorderTypeString(const QStringRef& str, const BorderStyle* const defaultBS) const
 {
     BorderStyle bs;
-    QStringList borderStr = str.split(" ");
-    QString s = borderStr.at(0);
-    s = s.remove("pt");
+    const QVector<QStringRef> borderStr = str.split(' ');
+    QStringRef s = borderStr.at(0);
+    if (s.endsWith(QLatin1String("pt")))
+        s = s.left(s.size() - 2);
 
-    if (s.size() > 0 && s != "none")
+    if (s.size() > 0 && s != QLatin1String("none"))
     {
+        const QStringRef type = borderStr.value(1);
+        const QColor color(borderStr.value(2).toString());
+
         bs.size     = s.toFloat();
-        bs.type     = borderStr.at(1);
-        bs.color    = borderStr.at(2);
+        bs.color    = color.isValid() ? color.rgba() : qRgb(0, 0, 0);
+
+        if (type == QLatin1String("dashed"))
+            bs.type = Qt::DashLine;
+        else if (type == QLatin1String("dotted"))
+            bs.type = Qt::DotLine;
+        else
+            bs.type = Qt::SolidLine;
     }
     else if (defaultBS != 0)
     {
@@ -324,106 +1430,521 @@ BorderStyle OdfPreviewLib::parseBorderTypeString(const QString str, const Border
     else
     {
         bs.size     = 0;
-        bs.type     = "";
-        bs.color    = "";
+        bs.type     = Qt::NoPen;
+        bs.color    = 0;
     }
+    bs.penId = -1;
 
     return bs;
 }
 
 
-void OdfPreviewLib::loadContentStyles()
+bool OdfPreviewLib::loadContent(QIODevice* device)
 {
-    // Loading styles of rows, columns, cells from document
-    QDomNodeList    nl = content.elementsByTagName("style:style");
-    for (int i = 0; i < nl.count(); i++)
+    resetSheet();
+    styleId(QStringRef());              // id 0 is reserved for cells without style
+    contentStyles.resize(0);
+
+    QXmlStreamReader xml(device);
+
+    int         depth = 0;              // depth of the current element
+    bool        inTable = false;
+    bool        inStyle = false;
+    quint32     styleName = 0;          // id of the style being read
+    CellStyle   style;
+    int         cellDepth = 0;          // depth of the current cell, 0 outside of cells
+    bool        paragraphSeen = false;
+    int         textDepth = 0;          // > 0 inside of the first paragraph of the cell
+
+    while (!xml.atEnd())
     {
-        QString name = nl.at(i).toElement().attribute("style:name");
-        QString styleFamily = nl.at(i).toElement().attribute("style:family");
-
-        CellStyle style;
-        style.width = 0;
-        style.height = 0;
-        style.fontName = "";
-        style.fontSize = 0;
-        style.align = Qt::AlignLeft;
-
-        BorderStyle bs;
-        bs.size = 0;
-        bs.type = "";
-        bs.color = "";
-        style.leftBS = bs;
-        style.rightBS = bs;
-        style.topBS = bs;
-        style.bottomBS = bs;
-
-        if (styleFamily == "table")
-        {
-            style.type = tableTable;
-        }
-        else if (styleFamily == "table-row")
+        switch (xml.readNext())
         {
-            style.type      = tableRow;
-            style.height    = QString(nl.at(i).firstChild().toElement().attribute("style:row-height").remove("mm")).toFloat();
+            case QXmlStreamReader::StartElement:
+            {
+                depth++;
+                if (textDepth > 0)
+                {
+                    textDepth++;
+                    break;
+                }
+
+                const QStringRef name = xml.qualifiedName();
+                const QXmlStreamAttributes attrs = xml.attributes();
+
+                if (name == QLatin1String("office:automatic-styles"))
+                    styleLoads.ref();
+                else if (name == QLatin1String("office:spreadsheet"))
+                    sheet.type = ods;
+                else if (name == QLatin1String("office:text"))
+                    sheet.type = odt;
+                else if (name == QLatin1String("style:style"))
+                {
+                    // Loading styles of rows, columns, cells from document
+                    inStyle = true;
+                    styleName = styleId(attribute(attrs, "style:name"));
+
+                    BorderStyle bs;
+                    bs.size = 0;
+                    bs.type = Qt::NoPen;
+                    bs.color = 0;
+                    bs.penId = -1;
+
+                    style = CellStyle();
+                    style.width = 0;
+                    style.height = 0;
+                    style.fontName = arena.string(QStringRef());
+                    style.fontSize = 0;
+                    style.backgroundColor = 0;
+                    style.align = Qt::AlignLeft;
+                    style.breakBefore = false;
+                    style.leftBS = bs;
+                    style.rightBS = bs;
+                    style.topBS = bs;
+                    style.bottomBS = bs;
+
+                    const QStringRef styleFamily = attribute(attrs, "style:family");
+                    if (styleFamily == QLatin1String("table"))
+                    {
+                        style.type = tableTable;
+                        style.masterPageName = arena.string(attribute(attrs, "style:master-page-name"));
+                    }
+                    else if (styleFamily == QLatin1String("table-row"))
+                        style.type = tableRow;
+                    else if (styleFamily == QLatin1String("table-column"))
+                        style.type = tableColumn;
+                    else if (styleFamily == QLatin1String("table-cell"))
+                        style.type = tableCell;
+                    else
+                        style.type = tableNone;
+                }
+                else if (inStyle && name == QLatin1String("style:table-row-properties"))
+                {
+                    style.height = attribute(attrs, "style:row-height").toString().remove("mm").toFloat();
+                    style.breakBefore = attribute(attrs, "fo:break-before") == QLatin1String("page");
+                }
+                else if (inStyle && name == QLatin1String("style:table-column-properties"))
+                {
+                    style.width = attribute(attrs, "style:column-width").toString().remove("mm").toFloat();
+                    style.breakBefore = attribute(attrs, "fo:break-before") == QLatin1String("page");
+                }
+                else if (inStyle && name == QLatin1String("style:text-properties"))
+                {
+                    style.fontName = arena.string(attribute(attrs, "style:font-name"));
+                    style.fontSize = attribute(attrs, "fo:font-size").toString().remove("pt").toInt();
+                }
+                else if (inStyle && name == QLatin1String("style:table-cell-properties"))
+                {
+                    BorderStyle bs = parseBorderTypeString(attribute(attrs, "fo:border"));   // default border style
+                    style.leftBS    = parseBorderTypeString(attribute(attrs, "fo:border-left"), &bs);
+                    style.rightBS   = parseBorderTypeString(attribute(attrs, "fo:border-right"), &bs);
+                    style.topBS     = parseBorderTypeString(attribute(attrs, "fo:border-top"), &bs);
+                    style.bottomBS  = parseBorderTypeString(attribute(attrs, "fo:border-bottom"), &bs);
+
+                    const QColor background(attribute(attrs, "fo:background-color").toString());
+                    style.backgroundColor = background.isValid() ? background.rgba() : 0;
+
+                    const QStringRef vAlignment = attribute(attrs, "style:vertical-align");
+                    if (vAlignment == QLatin1String("top"))
+                        style.align = style.align | Qt::AlignTop;
+                    else if (vAlignment == QLatin1String("bottom"))
+                        style.align = style.align | Qt::AlignBottom;
+                    else if (vAlignment == QLatin1String("middle"))
+                        style.align = style.align | Qt::AlignVCenter;
+                }
+                else if (inStyle && name == QLatin1String("style:paragraph-properties"))
+                {
+                    const QStringRef hAlignment = attribute(attrs, "fo:text-align");
+                    Qt::Alignment vAlign = style.align & Qt::AlignVertical_Mask;
+                    if (hAlignment == QLatin1String("start"))
+                        style.align = Qt::AlignLeft | vAlign;
+                    else if (hAlignment == QLatin1String("end"))
+                        style.align = Qt::AlignRight | vAlign;
+                    else if (hAlignment == QLatin1String("center"))
+                        style.align = Qt::AlignHCenter | vAlign;
+                }
+                else if (name == QLatin1String("table:table"))
+                {
+                    if (!inTable && sheet.rowCount() == 0 && sheet.columnCount() == 0)
+                        sheet.tableStyle = styleId(attribute(attrs, "table:style-name"));
+                    inTable = true;
+                }
+                else if (name == QLatin1String("table:table-column"))
+                {
+                    sheet.columnStyle.append(styleId(attribute(attrs, "table:style-name")));
+                    sheet.columnDefaultCellStyle.append(styleId(attribute(attrs, "table:default-cell-style-name")));
+                    sheet.columnRepeat.append(attribute(attrs, "table:number-columns-repeated").toUInt());
+                }
+                else if (name == QLatin1String("table:table-row"))
+                {
+                    sheet.rowStyle.append(styleId(attribute(attrs, "table:style-name")));
+                    sheet.rowRepeat.append(attribute(attrs, "table:number-rows-repeated").toUInt());
+                    sheet.rowFirstCell.append(sheet.cellCount());
+                }
+                else if ((name == QLatin1String("table:table-cell") || name == QLatin1String("table:covered-table-cell")) && sheet.rowCount() > 0)
+                {
+                    sheet.cellTextOffset.append(sheet.text.size());
+                    sheet.cellStyle.append(styleId(attribute(attrs, "table:style-name")));
+                    sheet.cellRowSpan.append(attribute(attrs, "table:number-rows-spanned").toUInt());
+                    sheet.cellColumnSpan.append(attribute(attrs, "table:number-columns-spanned").toUInt());
+                    sheet.cellRepeat.append(attribute(attrs, "table:number-columns-repeated").toUInt());
+                    sheet.cellFlags.append(name == QLatin1String("table:covered-table-cell") ? cellCovered : 0);
+
+                    cellDepth = depth;
+                    paragraphSeen = false;
+                }
+                else if (name == QLatin1String("text:p") && cellDepth > 0 && depth == cellDepth + 1 && !paragraphSeen)
+                {
+                    paragraphSeen = true;
+                    textDepth = 1;
+                }
+                break;
+            }
+            case QXmlStreamReader::EndElement:
+            {
+                depth--;
+                if (textDepth > 0)
+                {
+                    textDepth--;
+                    break;
+                }
+
+                const QStringRef name = xml.qualifiedName();
+                if (name == QLatin1String("style:style"))
+                {
+                    if (style.type != tableNone)
+                    {
+                        if (int(styleName) >= contentStyles.count())
+                            contentStyles.resize(styleName + 1);
+                        contentStyles[styleName] = style;
+                    }
+                    inStyle = false;
+                }
+                else if (name == QLatin1String("table:table"))
+                    inTable = false;
+                else if (name == QLatin1String("table:table-row"))
+                {
+                    // A loader reports progress and hands complete rows over,
+                    // the rows between snapshots double so copying them
+                    // stays linear
+                    if (loadCanceled())
+                        xml.raiseError("Loading cancelled");
+                    else if (publishTarget != nullptr)
+                    {
+                        if ((sheet.rowCount() & 255) == 0)
+                            publishTarget->loadTask.setProgressValue(int(qMin(device->pos(), qint64(INT_MAX))));
+                        if (sheet.rowCount() >= nextPublish)
+                        {
+                            publishSheet(false, true);
+                            nextPublish *= 2;
+                        }
+                    }
+                }
+                else if (depth < cellDepth)
+                    cellDepth = 0;
+                break;
+            }
+            case QXmlStreamReader::Characters:
+                if (textDepth > 0 && !xml.isWhitespace())
+                    sheet.text.append(xml.text());
+                break;
+            default:
+                break;
         }
-        else if (styleFamily == "table-column")
+    }
+
+    if (xml.hasError())
+    {
+        // A cancelled load is stopped through the reader, but is no error
+        if (!loadCanceled())
+            qWarning() << "content.xml:" << xml.lineNumber() << xml.errorString();
+        return false;
+    }
+
+    // Close ranges of the last row and the last cell
+    sheet.rowFirstCell.append(sheet.cellCount());
+    sheet.cellTextOffset.append(sheet.text.size());
+
+    // Styles used but not defined in content.xml are left empty
+    contentStyles.resize(sheet.styleNames.count());
+
+    // A loader leaves styles and layout to the instance it loads for
+    if (publishTarget != nullptr)
+        return true;
+
+    cacheStyleObjects();
+
+    layoutSheet();
+
+    return true;
+}
+
+
+void OdfPreviewLib::resetSheet()
+{
+    // All strings of the document go away at once
+    arena.release();
+
+    sheet.type = none;
+    sheet.tableStyle = 0;
+    sheet.styleNames.resize(0);
+    clearKeepingCapacity(sheet.styleIds);
+
+    sheet.columnStyle.resize(0);
+    sheet.columnDefaultCellStyle.resize(0);
+    sheet.columnRepeat.resize(0);
+
+    sheet.rowStyle.resize(0);
+    sheet.rowRepeat.resize(0);
+    sheet.rowFirstCell.resize(0);
+
+    sheet.text.resize(0);
+    sheet.cellTextOffset.resize(0);
+    sheet.cellStyle.resize(0);
+    sheet.cellRowSpan.resize(0);
+    sheet.cellColumnSpan.resize(0);
+    sheet.cellRepeat.resize(0);
+    sheet.cellFlags.resize(0);
+}
+
+
+// Looks the name up in place, only names seen for the first time are copied to the arena
+quint32 OdfPreviewLib::styleId(const QStringRef& name)
+{
+    QHash<OdsString, quint32>::const_iterator it = sheet.styleIds.constFind(odsStringView(name));
+    if (it != sheet.styleIds.constEnd())
+        return it.value();
+
+    const OdsString s = arena.string(name);
+    quint32 id = sheet.styleNames.count();
+    sheet.styleNames.append(s);
+    sheet.styleIds.insert(s, id);
+    return id;
+}
+
+
+void OdfPreviewLib::layoutSheet()
+{
+    // Calculate horizontal position of column runs
+    columnsPos.resize(sheet.columnCount());
+    qreal   x = 0;
+    quint32 column = 0;
+    for (int i = 0; i < sheet.columnCount(); i++)
+    {
+        ColumnPos& pos = columnsPos[i];
+        pos.x       = x;
+        pos.w       = styleOf(sheet.columnStyle.at(i)).width;
+        pos.first   = column;
+        pos.count   = qMax(sheet.columnRepeat.at(i), quint32(1));
+
+        x       += pos.w * pos.count;
+        column  += pos.count;
+    }
+
+    // Calculate vertical position of row runs. Trailing runs and columns
+    // without anything to print (LibreOffice writes up to the last row and
+    // column of the sheet) are laid out but never paginated or drawn.
+    rowsPos.resize(sheet.rowCount());
+    usedRowRuns = 0;
+    usedColumns = 0;
+    qreal   y = 0;
+    quint32 row = 0;
+    for (int i = 0; i < sheet.rowCount(); i++)
+    {
+        RowPos& pos = rowsPos[i];
+        pos.y       = y;
+        pos.h       = styleOf(sheet.rowStyle.at(i)).height;
+        pos.first   = row;
+        pos.count   = qMax(sheet.rowRepeat.at(i), quint32(1));
+        pos.visible = false;
+
+        column = 0;
+        for (quint32 c = sheet.rowFirstCell.at(i); c < sheet.rowFirstCell.at(i + 1); c++)
         {
-            style.type  = tableColumn;
-            style.width = QString(nl.at(i).firstChild().toElement().attribute("style:column-width").remove("mm")).toFloat();
+            const quint32 end = visibleCellEnd(c, column);
+            if (end > 0)
+            {
+                pos.visible = true;
+                usedColumns = qMax(usedColumns, end);
+            }
+            column += qMax(sheet.cellRepeat.at(c), quint32(1));
         }
-        else if (styleFamily == "table-cell")
-        {
-            style.type      = tableCell;
-            style.fontName  = nl.at(i).firstChildElement("style:text-properties").attribute("style:font-name");
-            style.fontSize  = QString(nl.at(i).firstChildElement("style:text-properties").attribute("fo:font-size").remove("pt")).toInt();
-
-            QDomElement n = nl.at(i).firstChildElement("style:table-cell-properties");
-            bs = parseBorderTypeString(n.attribute("fo:border"));                           // default border style
-            style.leftBS    = parseBorderTypeString(n.attribute("fo:border-left"), &bs);
-            style.rightBS   = parseBorderTypeString(n.attribute("fo:border-right"), &bs);
-            style.topBS     = parseBorderTypeString(n.attribute("fo:border-top"), &bs);
-            style.bottomBS  = parseBorderTypeString(n.attribute("fo:border-bottom"), &bs);
-
-            style.backgroundColor = nl.at(i).firstChild().toElement().attribute("fo:background-color");
-
-            QString hAlignment = nl.at(i).firstChildElement("style:paragraph-properties").attribute("fo:text-align");
-            if (hAlignment == "start")
-                style.align = Qt::AlignLeft;
-            else if (hAlignment == "end")
-                style.align = Qt::AlignRight;
-            else if (hAlignment == "center")
-                style.align = Qt::AlignHCenter;
-
-            QString vAlignment = nl.at(i).firstChildElement("style:table-cell-properties").attribute("style:vertical-align");
-
-            if (vAlignment == "top")
-                style.align = style.align | Qt::AlignTop;
-            else if (vAlignment == "bottom")
-                style.align = style.align | Qt::AlignBottom;
-            else if (vAlignment == "middle")
-                style.align = style.align | Qt::AlignVCenter;
+        if (pos.visible)
+            usedRowRuns = i + 1;
 
-        }
-        else
+        y   += pos.h * pos.count;
+        row += pos.count;
+    }
+}
+
+
+// Creates fonts, text options and border pens once per document, cells of
+// different styles with the same font or border share one QFont or QPen.
+void OdfPreviewLib::cacheStyleObjects()
+{
+    QHash<QPair<QString, int>, int> fontIds;
+    QHash<QString, int>             penIds;
+
+    fonts.resize(0);
+    borderPens.resize(0);
+
+    for (int i = 0; i < contentStyles.count(); i++)
+    {
+        CellStyle& style = contentStyles[i];
+
+        const QPair<QString, int> key(style.fontName.toString(), style.fontSize);
+        QHash<QPair<QString, int>, int>::const_iterator it = fontIds.constFind(key);
+        if (it == fontIds.constEnd())
         {
-            style.type = tableNone;
+            it = fontIds.insert(key, fonts.count());
+            fonts.append(QFont(key.first, style.fontSize));
         }
+        style.fontId = it.value();
+
+        style.textOption = QTextOption();
+        style.textOption.setWrapMode(QTextOption::WrapAtWordBoundaryOrAnywhere);
+        style.textOption.setAlignment(style.align);
+
+        style.leftBS.penId      = borderPenId(penIds, style.leftBS);
+        style.rightBS.penId     = borderPenId(penIds, style.rightBS);
+        style.topBS.penId       = borderPenId(penIds, style.topBS);
+        style.bottomBS.penId    = borderPenId(penIds, style.bottomBS);
+    }
+}
+
+
+int OdfPreviewLib::borderPenId(QHash<QString, int>& penIds, const BorderStyle& bs)
+{
+    if (bs.size <= 0)
+        return -1;
+
+    const QString key = QString("%1 %2 %3").arg(bs.size).arg(int(bs.type)).arg(bs.color);
+    QHash<QString, int>::const_iterator it = penIds.constFind(key);
+    if (it != penIds.constEnd())
+        return it.value();
+
+    QPen pen(QColor::fromRgba(bs.color));
+    pen.setWidthF(bs.size);
+    pen.setStyle(bs.type);
+
+    borderPens.append(pen);
+    penIds.insert(key, borderPens.count() - 1);
+    return borderPens.count() - 1;
+}
+
+
+// Style of the id, unknown ids of a damaged snapshot get the empty style 0
+const CellStyle& OdfPreviewLib::styleOf(quint32 id) const
+{
+    return contentStyles.at(id < quint32(contentStyles.count()) ? int(id) : 0);
+}
+
+
+bool OdfPreviewLib::isVisible(const CellStyle& style) const
+{
+    return qAlpha(style.backgroundColor) > 0 ||
+           style.leftBS.size > 0 || style.rightBS.size > 0 ||
+           style.topBS.size > 0 || style.bottomBS.size > 0;
+}
+
 
-        if (style.type != tableNone)
-            contentStyles.insert(name, style);
+// Vertical offset of the row in the sheet, rows past the end are at the bottom
+qreal OdfPreviewLib::rowOffset(quint32 row) const
+{
+    const RowPos* it = std::upper_bound(rowsPos.constBegin(), rowsPos.constEnd(), row,
+                                                          [](quint32 r, const RowPos& pos) { return r < pos.first; });
+    if (it == rowsPos.constBegin())
+        return 0;
+
+    --it;
+    return it->y + qMin(row - it->first, it->count) * it->h;
+}
+
+
+// Index of the column run containing the column, the number of runs past the end
+int OdfPreviewLib::columnRun(quint32 column) const
+{
+    const ColumnPos* it = std::upper_bound(columnsPos.constBegin(), columnsPos.constEnd(), column,
+                                                             [](quint32 c, const ColumnPos& pos) { return c < pos.first; });
+    if (it == columnsPos.constBegin())
+        return columnsPos.count();
+
+    --it;
+    if (column - it->first >= it->count)
+        return columnsPos.count();
+
+    return it - columnsPos.constBegin();
+}
+
+
+// Horizontal offset of the column in the sheet, columns past the end are at the right edge
+qreal OdfPreviewLib::columnOffset(quint32 column) const
+{
+    const ColumnPos* it = std::upper_bound(columnsPos.constBegin(), columnsPos.constEnd(), column,
+                                                             [](quint32 c, const ColumnPos& pos) { return c < pos.first; });
+    if (it == columnsPos.constBegin())
+        return 0;
+
+    --it;
+    return it->x + qMin(column - it->first, it->count) * it->w;
+}
+
+
+// End (exclusive) of the columns painted by the cell starting at the column, 0 if the cell paints nothing
+quint32 OdfPreviewLib::visibleCellEnd(quint32 c, quint32 column) const
+{
+    if (sheet.cellFlags.at(c) & cellCovered)
+        return 0;
+
+    const quint32 repeat    = qMax(sheet.cellRepeat.at(c), quint32(1));
+    const quint32 span      = qMax(sheet.cellColumnSpan.at(c), quint32(1));
+    const bool    hasText   = sheet.cellTextOffset.at(c + 1) > sheet.cellTextOffset.at(c);
+
+    if (hasText || isVisible(styleOf(sheet.cellStyle.at(c))))
+        return column + repeat - 1 + span;
+
+    if (sheet.cellStyle.at(c) != 0)
+        return 0;
+
+    // Cell without style is painted with default cell styles of its columns
+    quint32 end = 0;
+    for (int i = columnRun(column); i < columnsPos.count() && columnsPos.at(i).first < column + repeat; i++)
+    {
+        if (isVisible(styleOf(sheet.columnDefaultCellStyle.at(i))))
+            end = qMin(columnsPos.at(i).first + columnsPos.at(i).count, column + repeat) - 1 + span;
     }
+    return end;
+}
+
+
+// A4 portrait without margins, used for missing sizes and unresolved page styles
+static PageStyle defaultPageStyle()
+{
+    PageStyle style;
+    style.width         = 210;
+    style.height        = 297;
+    style.orientation   = QPrinter::Portrait;
+    style.marginTop     = 0;
+    style.marginBottom  = 0;
+    style.marginLeft    = 0;
+    style.marginRight   = 0;
+    style.scale         = 1;
+    style.leftToRight   = false;
+    return style;
 }
 
 
-void OdfPreviewLib::loadPageStyles()
+void OdfPreviewLib::loadPageStyles(const QDomDocument& styles)
 {
+    styleLoads.ref();
+
     QDomNodeList    nl = styles.elementsByTagName("style:page-layout");
     for (int i = 0; i < nl.count(); i++)
     {
         QString name = nl.at(i).toElement().attribute("style:name");
         QDomElement e = nl.at(i).toElement().firstChildElement("style:page-layout-properties");
 
-        PageStyle style;
+        PageStyle style = defaultPageStyle();
         style.width         = QString(e.attribute("fo:page-width").remove("mm")).toFloat();
         if (style.width == 0)
             style.width = 210;
@@ -435,6 +1956,7 @@ void OdfPreviewLib::loadPageStyles()
         style.marginBottom  = QString(e.attribute("fo:margin-bottom").remove("mm")).toFloat();
         style.marginLeft    = QString(e.attribute("fo:margin-left").remove("mm")).toFloat();
         style.marginRight   = QString(e.attribute("fo:margin-right").remove("mm")).toFloat();
+        style.leftToRight   = e.attribute("style:print-page-order") == "ltr";
 
         pageStyles.insert(name, style);
     }
@@ -449,13 +1971,11 @@ void OdfPreviewLib::loadPageStyles()
 }
 
 
-QDomNode OdfPreviewLib::firstNodeWithAttribute(const QDomNodeList nl, const QString attr, const QString val)
+void OdfPreviewLib::resolvePageStyle()
 {
-    for (int i = 0; i < nl.count(); i++)
-    {
-        if (nl.at(i).toElement().attribute(attr) == val)
-            return nl.at(i);
-    }
-    return QDomNode();
+    QString pageStyleName = contentStyles.value(sheet.tableStyle).masterPageName.toString();
+    pageStyleName = sheetPrintStyleNames.value(pageStyleName);
+    // Without a page style (no master page, no styles.xml, documents opened
+    // from a QDomDocument) pages fall back to A4, as pageSize() does
+    sheetPageStyle = pageStyles.value(pageStyleName, defaultPageStyle());
 }
-
@@ -2,12 +2,28 @@
 #define OdfPreviewLib_H
 
 #include <QtCore/QObject>
+#include <QtCore/QVector>
+#include <QtCore/QHash>
+#include <QtCore/QCache>
+#include <QtCore/QStringList>
+#include <QtCore/QIODevice>
+#include <QtCore/QFile>
+#include <QtCore/QFuture>
+#include <QtCore/QFutureInterface>
+#include <QtCore/QMutex>
+#include <QtCore/QAtomicInt>
 #include <QtGui/QPainter>
+#include <QtGui/QTextOption>
+#include <QtGui/QImage>
+#include <QtGui/QColor>
+#include <QtGui/QPagedPaintDevice>
 #include <QtPrintSupport/QPrinter>
 #include <QtPrintSupport/QPrintPreviewDialog>
 #include <QtXml/QDomDocument>
 
 #include "odfpreviewlib_global.h"
+#include "odsarena.h"
+#include "odsarray.h"
 
 
 enum DocType {none, ods, odt};
@@ -16,9 +32,40 @@ enum StyleFamily {tableNone, tableTable, tableRow, tableColumn, tableCell};
 
 struct BorderStyle
 {
-    qreal       size;
-    QString     type;
-    QString     color;
+    qreal           size;
+    Qt::PenStyle    type;
+    QRgb            color;
+    int             penId;      // index in the border pen cache of the document
+};
+
+
+// Border line in device coordinates, shared edges of adjacent cells are equal
+struct BorderEdge
+{
+    int         x1;
+    int         y1;
+    int         x2;
+    int         y2;
+};
+
+inline bool operator==(const BorderEdge& a, const BorderEdge& b)
+{
+    return a.x1 == b.x1 && a.y1 == b.y1 && a.x2 == b.x2 && a.y2 == b.y2;
+}
+
+inline uint qHash(const BorderEdge& e, uint seed = 0)
+{
+    return qHash((quint64(quint32(e.x1)) << 32) | quint32(e.y1), seed) ^
+           qHash((quint64(quint32(e.x2)) << 32) | quint32(e.y2), seed);
+}
+
+
+// Borders of one page collected before drawing, one pen per distinct edge
+struct BorderBatch
+{
+    QHash<BorderEdge, int>  index;      // edge -> position in edges
+    QVector<BorderEdge>     edges;
+    QVector<int>            penIds;
 };
 
 
@@ -27,14 +74,18 @@ struct CellStyle
     StyleFamily         type;
     qreal               width;
     qreal               height;
-    QString             fontName;
+    OdsString           fontName;
     int                 fontSize;
     Qt::Alignment       align;
     BorderStyle         leftBS;     // left border style
     BorderStyle         rightBS;
     BorderStyle         topBS;
     BorderStyle         bottomBS;
-    QString             backgroundColor;
+    QRgb                backgroundColor;    // transparent if there is no background
+    OdsString           masterPageName;     // for table styles only
+    bool                breakBefore;    // manual page break before row or column
+    int                 fontId;         // index in the font cache of the document
+    QTextOption         textOption;
 };
 
 
@@ -48,21 +99,92 @@ struct PageStyle
     qreal                   marginLeft;
     qreal                   marginRight;
     qreal                   scale;
+    bool                    leftToRight;    // page order, top to bottom by default
 };
 
 
+// Run of identical rows written as one table:table-row with table:number-rows-repeated
 struct RowPos
 {
-    qreal       y;
-    qreal       h;
+    qreal       y;          // top of the first row of the run
+    qreal       h;          // height of one row
+    quint32     first;      // index of the first row of the run
+    quint32     count;
+    bool        visible;    // run has cells with text, background or borders
 };
 
+// Run of identical columns written as one table:table-column with table:number-columns-repeated
 struct ColumnPos
 {
-    qreal       x;
-    qreal       w;
+    qreal       x;          // left of the first column of the run
+    qreal       w;          // width of one column
+    quint32     first;      // index of the first column of the run
+    quint32     count;
+};
+
+enum SheetCellFlag {cellCovered = 0x01};
+
+
+// Compact columnar representation of content.xml filled by the streaming loader.
+// Cells of row r are [rowFirstCell[r], rowFirstCell[r + 1]), text of cell c is
+// [cellTextOffset[c], cellTextOffset[c + 1]) of the text pool. Arrays and text
+// of an opened snapshot view its mapping.
+struct SheetModel
+{
+    DocType                 type;
+    quint32                 tableStyle;     // style of the first table
+    QVector<OdsString>      styleNames;     // style id -> style name, id 0 is empty name
+    QHash<OdsString, quint32> styleIds;
+
+    OdsArray<quint32>       columnStyle;
+    OdsArray<quint32>       columnDefaultCellStyle;
+    OdsArray<quint32>       columnRepeat;
+
+    OdsArray<quint32>       rowStyle;
+    OdsArray<quint32>       rowRepeat;
+    OdsArray<quint32>       rowFirstCell;   // rows + 1 entries
+
+    QString                 text;           // text of the first paragraph of all cells
+    OdsArray<quint32>       cellTextOffset; // cells + 1 entries
+    OdsArray<quint32>       cellStyle;
+    OdsArray<quint32>       cellRowSpan;
+    OdsArray<quint32>       cellColumnSpan;
+    OdsArray<quint32>       cellRepeat;
+    OdsArray<quint8>        cellFlags;
+
+    int                     rowCount() const    { return rowStyle.count(); }
+    int                     columnCount() const { return columnStyle.count(); }
+    int                     cellCount() const   { return cellStyle.count(); }
+};
+
+
+// Range of rows or columns printed on one page
+struct PageBand
+{
+    quint32     first;
+    quint32     last;       // exclusive
+    qreal       offset;     // offset of the first row or column in the sheet
 };
 
+
+// Part of the sheet printed on one page
+struct SheetPage
+{
+    PageBand    rows;
+    PageBand    columns;
+};
+
+
+// State of one rendering, pages may be rendered concurrently with own contexts
+struct PaintContext
+{
+    QPainter*   painter;
+    qreal       resolution;     // of the device being painted
+    int         fontId;         // font set to the painter, -1 if unknown
+    bool        draft;          // text on one line and elided, no wrapping
+};
+
+
 class OdfPreviewLibSHARED_EXPORT OdfPreviewLib : public QObject
 {
     Q_OBJECT
@@ -77,31 +199,172 @@ public:
     void preview();
     void print();
 
+    // Rendering without printer and preview dialog. Pages are 0-based,
+    // negative last page means the last page of the document. Draft pages
+    // have cell text on one line, elided instead of wrapped, and images
+    // are rendered without antialiasing.
+    bool   render(QPagedPaintDevice*, int firstPage = 0, int lastPage = -1);
+    void   renderPage(QPainter*, int page, bool draft = false) const;
+    QImage renderToImage(int page, int dpi = 96, bool draft = false) const;
+    bool   renderToPdf(const QString&);
+    QSizeF pageSize() const;        // in millimeters
+
+    // Renders pages into images on the global thread pool, one page per
+    // task. Images are returned in page order.
+    QVector<QImage> renderToImages(int dpi = 96, int firstPage = 0, int lastPage = -1) const;
+
+    // When dpi > 0, render() (and so preview(), print() and renderToPdf())
+    // rasterizes pages in parallel at this resolution and paints the images
+    // in order, holding at most one image per pool thread. 0 (default)
+    // paints vector output on the calling thread.
+    void   setParallelRendering(int dpi);
+
+    // Pages generated for the preview dialog are kept as images rendered
+    // at its resolution rounded up to a multiple of 32 dpi, so repainting
+    // after zooming or scrolling only draws images. Least recently used
+    // pages are dropped beyond this many kilobytes, 0 (default) disables
+    // the cache. Printing and PDF export, from the dialog too, go through
+    // render() and never use cached images.
+    void   setPageCacheSize(int kilobytes);
+
+    // When dpi > 0 the preview dialog shows draft pages rendered at no more
+    // than this resolution, so scrolling stays responsive on big documents.
+    // Only pages generated for the preview are drafted, printing and PDF
+    // export keep full quality, from the dialog too. 0 (default) disables it.
+    void   setDraftPreview(int dpi);
+
+    // Preview image of a package for file lists. Only the central directory
+    // and Thumbnails/thumbnail.png are read. Packages without a thumbnail
+    // are opened and their first page is rendered as a draft at the given
+    // resolution.
+    static QImage thumbnail(const QString&, int fallbackDpi = 24);
+
+    // Number of style sheets parsed so far. Repeated drawing of the same
+    // document must not change it, styles are parsed once per open().
+    int  styleLoadCount() const;
+
+    // Number of pages of the opened document, known right after open()
+    int  pageCount() const;
+
+    // Returns once page styles are loaded, content is parsed on a worker
+    // thread. Parsed rows are paginated in the thread of this object as
+    // they arrive, pagesAvailable() reports the growing page count and an
+    // open preview is refreshed. loadFinished() is emitted at the end.
+    bool openProgressive(const QString);
+    bool isLoading() const;
+
+    // Like openProgressive(), but page styles are loaded on a worker too.
+    // The future reports bytes of content.xml parsed out of its size and
+    // can be canceled, which stops parsing at the next row. It finishes on
+    // the worker once parsing is done and may be waited on from any thread.
+    // The parsed document is applied by the event loop of the thread of
+    // this object afterwards, before a QFutureWatcher in that thread sees
+    // the future finish. loadFinished() is emitted then.
+    QFuture<bool> openAsync(const QString);
+
+    // Documents compiled by open() are stored in this directory as
+    // snapshots, keyed by CRC32 and size of content.xml and styles.xml and
+    // the library version. Reopening an unchanged document maps its
+    // snapshot and skips inflating, parsing and layout. Empty (default)
+    // disables it.
+    void setCacheDirectory(const QString&);
+
+    // Binary snapshot of the opened document, see odssnapshot.h. Opening
+    // one maps the file, arrays, names and text are used in place from the
+    // mapping, only styles are converted. Nothing is parsed, laid out or
+    // copied per cell. The file must not change while the document is open.
+    bool saveSnapshot(const QString) const;
+    bool openSnapshot(const QString);
+
+signals:
+    void pagesAvailable(int count);
+    void loadFinished(bool ok);
+
 private slots:
     void draw(QPrinter*);
+    void applyLoadedSheet();
 
 private:
-    QPrinter*                   printer;
-    QPrintPreviewDialog*        printPreview;
-    QDomDocument                content;
-    QDomDocument                styles;
-    QHash<QString, CellStyle>   contentStyles;
+    QWidget*                    parentWidget;
+    QPrinter*                   printer;            // created on demand
+    QPrintPreviewDialog*        printPreview;       // created on demand
+    int                         rasterDpi;          // parallel rendering resolution, 0 if disabled
+    QCache<quint64, QImage>     pageImages;         // preview pages by dpi and page, cost in kilobytes
+    int                         draftDpi;           // resolution limit of draft preview, 0 if disabled
+    QString                     cacheDirectory;     // empty if documents are not cached
+    QFile                       snapshotFile;       // opened snapshot
+    uchar*                      snapshotData;       // its mapping, nullptr if none
+    OdsArena                    arena;              // strings of the opened document
+    SheetModel                  sheet;
+    QVector<CellStyle>          contentStyles;      // indexed by style id of the sheet
     QHash<QString, PageStyle>   pageStyles;
     QHash<QString, QString>     sheetPrintStyleNames;
-    QHash<int, RowPos>          rowsPos;
-    QHash<int, ColumnPos>       columnsPos;
+    PageStyle                   sheetPageStyle;     // page style of the first table
+    QAtomicInt                  styleLoads;         // styles.xml is counted on its own thread
+    OdsArray<RowPos>            rowsPos;            // one entry per row run
+    int                         usedRowRuns;        // runs up to the last visible one
+    OdsArray<ColumnPos>         columnsPos;         // one entry per column run
+    quint32                     usedColumns;        // columns up to the last visible cell
+    OdsArray<SheetPage>         pages;
+    QVector<QFont>              fonts;              // distinct fonts of cell styles
+    QVector<QPen>               borderPens;         // distinct border pens, width in points
+
+    OdfPreviewLib*              loader;             // parses content for openProgressive()
+    OdfPreviewLib*              publishTarget;      // set if this is a loader of another instance
+    QFuture<bool>               loading;
+    QFuture<bool>               stylesLoading;      // page styles of openAsync()
+    bool                        loadingStyles;
+    QFutureInterface<bool>      loadTask;           // progress and result of the load
+    bool                        loadingContent;
+    QAtomicInt                  cancelLoad;         // set to stop a loader at the next row
+    int                         nextPublish;        // row count of the next snapshot of a loader
+    QMutex                      loadedMutex;        // guards the snapshot handed over by the loader
+    SheetModel                  loadedSheet;
+    QVector<CellStyle>          loadedStyles;
+    bool                        loadedPending;
+    bool                        loadedFinished;
+    bool                        loadedOk;
 
     bool                        unzip(QString);
+    bool                        unzipStyles(QString);
+    bool                        unzipContent(QString);
+    QString                     cacheFileName(const QString&) const;
+    bool                        loadSnapshot(const QString&);
+    void                        startLoader(const QString&);
+    bool                        loadProgressive(QString);
+    bool                        loadCanceled() const;
+    void                        publishSheet(bool, bool);
+    void                        receiveSheet(const SheetModel&, const QVector<CellStyle>&, bool, bool);
+    bool                        loadContent(QIODevice*);
+    quint32                     styleId(const QStringRef&);
+    void                        resetSheet();
+    void                        layoutSheet();
+    void                        cacheStyleObjects();
+    int                         borderPenId(QHash<QString, int>&, const BorderStyle&);
+    const CellStyle&            styleOf(quint32) const;
+    bool                        isVisible(const CellStyle&) const;
+    qreal                       rowOffset(quint32) const;
+    int                         columnRun(quint32) const;
+    qreal                       columnOffset(quint32) const;
+    quint32                     visibleCellEnd(quint32, quint32) const;
     DocType                     getDocType() const;
+    void                        createPrinter();
     void                        setPrinterConfig();
-    void                        drawOds(QPainter*);
-    void                        drawOdt(QPainter*);
-
-    qreal                       mmToPixels(qreal) const;
-    BorderStyle                 parseBorderTypeString(const QString, const BorderStyle* const = 0) const;
-    void                        loadContentStyles();
-    void                        loadPageStyles();
-    QDomNode                    firstNodeWithAttribute(const QDomNodeList, const QString, const QString);
+    void                        paginate();
+    void                        paginateRun(QVector<PageBand>&, PageBand&, qreal, qreal, quint32, quint32, bool, qreal) const;
+    bool                        renderCached(QPagedPaintDevice*, int, int, bool draft);
+    void                        paintImages(QPainter&, QPagedPaintDevice*, int, int, int dpi, bool draft, bool cached);
+    QVector<QImage>             renderToImages(int, const QVector<int>&, bool) const;
+    void                        drawOdsPage(PaintContext&, int) const;
+    void                        drawOdsRow(PaintContext&, int, quint32, qreal, const SheetPage&, BorderBatch&) const;
+    void                        addBorder(BorderBatch&, const BorderEdge&, int) const;
+    void                        drawBorders(PaintContext&, const BorderBatch&) const;
+    void                        drawOdt(PaintContext&) const;
+
+    qreal                       mmToPixels(qreal, qreal) const;
+    BorderStyle                 parseBorderTypeString(const QStringRef&, const BorderStyle* const = 0) const;
+    void                        loadPageStyles(const QDomDocument&);
+    void                        resolvePageStyle();
 };
 
 #endif // OdfPreviewLib_H
@@ -4,12 +4,13 @@
 #
 #-------------------------------------------------
 
-QT       += core gui xml printsupport
+QT       += core gui xml printsupport concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += printsupport
 
 TARGET = odfpreviewlib
 TEMPLATE = lib
+CONFIG += c++11
 #DESTDIR = ../
 
 DEFINES += OdfPreviewLib_LIBRARY
@@ -26,11 +27,17 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
-        odfpreviewlib.cpp
+        odfpreviewlib.cpp \
+        odsarena.cpp \
+        odsinflatepipe.cpp
 
 HEADERS += \
         odfpreviewlib.h \
-        odfpreviewlib_global.h 
+        odfpreviewlib_global.h \
+        odsarena.h \
+        odsarray.h \
+        odsinflatepipe.h \
+        odssnapshot.h
 
 unix {
     target.path = /usr/lib
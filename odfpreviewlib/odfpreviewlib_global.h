@@ -9,4 +9,7 @@
 #  define OdfPreviewLibSHARED_EXPORT Q_DECL_IMPORT
 #endif
 
+// 0xMMNNPP, part of the key of cached documents
+#define OdfPreviewLib_VERSION 0x000100
+
 #endif // OdfPreviewLib_GLOBAL_H
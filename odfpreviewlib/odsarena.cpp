@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+#include "odsarena.h"
+
+
+OdsArena::OdsArena(int size)
+{
+    chunkSize   = size;
+    current     = -1;
+    used        = 0;
+}
+
+
+OdsArena::~OdsArena()
+{
+    for (int i = 0; i < chunks.count(); i++)
+        free(chunks.at(i));
+}
+
+
+void* OdsArena::allocate(int size, int align)
+{
+    int offset = (used + align - 1) & ~(align - 1);
+
+    if (current < 0 || offset + size > chunkSizes.at(current))
+    {
+        // Chunks kept by release() are used again in order, those too small
+        // for the block are skipped for this document
+        do
+            current++;
+        while (current < chunks.count() && chunkSizes.at(current) < size);
+
+        if (current == chunks.count())
+        {
+            // Blocks larger than a chunk get a chunk of their own
+            const int newSize = qMax(size, chunkSize);
+            char* chunk = static_cast<char*>(malloc(newSize));
+            Q_CHECK_PTR(chunk);
+
+            chunks.append(chunk);
+            chunkSizes.append(newSize);
+        }
+        offset = 0;
+    }
+
+    used = offset + size;
+    return chunks.at(current) + offset;
+}
+
+
+OdsString OdsArena::string(const QStringRef& str)
+{
+    if (str.isEmpty())
+    {
+        OdsString s = {nullptr, 0};
+        return s;
+    }
+
+    QChar* data = static_cast<QChar*>(allocate(str.size() * sizeof(QChar), Q_ALIGNOF(QChar)));
+    memcpy(data, str.unicode(), str.size() * sizeof(QChar));
+
+    OdsString s = {data, str.size()};
+    return s;
+}
+
+
+void OdsArena::release()
+{
+    // Chunks are rewound, not freed, a document of the same size reuses them all
+    current = -1;
+    used = 0;
+}
+
+
+qint64 OdsArena::bytesAllocated() const
+{
+    qint64 bytes = 0;
+    for (int i = 0; i < chunkSizes.count(); i++)
+        bytes += chunkSizes.at(i);
+    return bytes;
+}
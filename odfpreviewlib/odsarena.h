@@ -0,0 +1,62 @@
+#ifndef OdsArena_H
+#define OdsArena_H
+
+#include <string.h>
+#include <QtCore/QString>
+#include <QtCore/QStringRef>
+#include <QtCore/QVector>
+#include <QtCore/QHash>
+
+
+// String stored in an OdsArena, valid until the arena is released
+struct OdsString
+{
+    const QChar*    data;
+    int             size;
+
+    bool            isEmpty() const     { return size == 0; }
+    QString         toString() const    { return QString(data, size); }
+};
+
+inline OdsString odsStringView(const QStringRef& str)
+{
+    OdsString s = {str.unicode(), str.size()};
+    return s;
+}
+
+inline bool operator==(const OdsString& a, const OdsString& b)
+{
+    return a.size == b.size && (a.size == 0 || a.data == b.data || memcmp(a.data, b.data, a.size * sizeof(QChar)) == 0);
+}
+
+inline uint qHash(const OdsString& s, uint seed = 0)
+{
+    return qHashBits(s.data, s.size * sizeof(QChar), seed);
+}
+
+
+// Monotonic allocator for data of one document. Memory is taken from large
+// chunks and given back all at once by release(), nothing is freed one by one.
+// Released chunks are kept for the next document and freed by the destructor.
+class OdsArena
+{
+public:
+    explicit OdsArena(int chunkSize = 64 * 1024);
+    ~OdsArena();
+
+    void*       allocate(int size, int align = Q_ALIGNOF(void*));
+    OdsString   string(const QStringRef&);
+    void        release();          // keeps all chunks for the next document
+    qint64      bytesAllocated() const;
+
+private:
+    Q_DISABLE_COPY(OdsArena)
+
+    QVector<char*>  chunks;
+    QVector<int>    chunkSizes;
+    int             chunkSize;
+    int             current;        // chunk being filled, -1 before the first allocation
+    int             used;           // bytes used in the current chunk
+};
+
+#endif // OdsArena_H
@@ -0,0 +1,102 @@
+#ifndef OdsArray_H
+#define OdsArray_H
+
+#include <QtCore/QVector>
+
+
+// Array of plain records, kept in a QVector or viewing memory owned by
+// someone else, like a mapped snapshot. Reads go through one pointer in
+// both cases. The first change of a view copies it into the vector, as
+// with QString::fromRawData(). Copies share the vector.
+template <typename T>
+class OdsArray
+{
+public:
+    typedef const T* const_iterator;
+
+    OdsArray() : ptr(storage.constData()), n(0), view(false) {}
+    OdsArray(const OdsArray& other)
+        : storage(other.storage), ptr(other.view ? other.ptr : storage.constData()), n(other.n), view(other.view) {}
+
+    OdsArray& operator=(const OdsArray& other)
+    {
+        storage = other.storage;
+        ptr     = other.view ? other.ptr : storage.constData();
+        n       = other.n;
+        view    = other.view;
+        return *this;
+    }
+
+    // The data must stay valid as long as the array or a copy of it views it
+    static OdsArray fromRawData(const T* data, int size)
+    {
+        OdsArray array;
+        array.ptr   = data;
+        array.n     = size;
+        array.view  = true;
+        return array;
+    }
+
+    int             count() const               { return n; }
+    int             size() const                { return n; }
+    bool            isEmpty() const             { return n == 0; }
+    const T&        at(int i) const             { Q_ASSERT(i >= 0 && i < n); return ptr[i]; }
+    const T&        operator[](int i) const     { return at(i); }
+    const T&        first() const               { return at(0); }
+    const T&        last() const                { return at(n - 1); }
+    const T*        constData() const           { return ptr; }
+    const_iterator  constBegin() const          { return ptr; }
+    const_iterator  constEnd() const            { return ptr + n; }
+
+    T& operator[](int i)
+    {
+        Q_ASSERT(i >= 0 && i < n);
+        detach();
+        T& item = storage[i];
+        ptr = storage.constData();
+        return item;
+    }
+
+    void append(const T& item)
+    {
+        detach();
+        storage.append(item);
+        sync();
+    }
+
+    // Like QVector::resize(), shrinking keeps the capacity
+    void resize(int size)
+    {
+        if (view && size == 0)
+            view = false;
+        detach();
+        storage.resize(size);
+        sync();
+    }
+
+private:
+    void detach()
+    {
+        if (!view)
+            return;
+        storage = QVector<T>();
+        storage.reserve(n);
+        for (int i = 0; i < n; i++)
+            storage.append(ptr[i]);
+        view = false;
+        sync();
+    }
+
+    void sync()
+    {
+        ptr = storage.constData();
+        n   = storage.count();
+    }
+
+    QVector<T>      storage;        // unused while viewing
+    const T*        ptr;
+    int             n;
+    bool            view;
+};
+
+#endif // OdsArray_H
@@ -0,0 +1,184 @@
+#include <string.h>
+#include "odsinflatepipe.h"
+#include "quazip/quazip.h"
+#include "quazip/quazipfile.h"
+
+
+OdsInflatePipe::OdsInflatePipe(const QString& fileName, const QString& entryName, int chunkSize, int chunkCount)
+    : fileName(fileName)
+    , entryName(entryName)
+    , producer(this)
+{
+    chunks.resize(qMax(chunkCount, 2));
+    for (int i = 0; i < chunks.count(); i++)
+    {
+        chunks[i].data.resize(chunkSize);
+        chunks[i].size = 0;
+    }
+    head        = 0;
+    count       = 0;
+    readPos     = 0;
+    bytesRead   = 0;
+    finished    = false;
+    error       = false;
+    cancelled   = false;
+}
+
+
+OdsInflatePipe::~OdsInflatePipe()
+{
+    close();
+}
+
+
+bool OdsInflatePipe::open(OpenMode mode)
+{
+    if (isOpen() || (mode & WriteOnly))
+        return false;
+
+    head        = 0;
+    count       = 0;
+    readPos     = 0;
+    bytesRead   = 0;
+    finished    = false;
+    error       = false;
+    cancelled   = false;
+
+    // Data is copied straight from the ring, QIODevice needs no buffer of its own
+    QIODevice::open(mode | Unbuffered);
+    producer.start();
+    return true;
+}
+
+
+void OdsInflatePipe::close()
+{
+    if (!isOpen())
+        return;
+
+    mutex.lock();
+    cancelled = true;
+    notFull.wakeAll();
+    mutex.unlock();
+
+    producer.wait();
+    QIODevice::close();
+}
+
+
+bool OdsInflatePipe::atEnd() const
+{
+    QMutexLocker locker(&mutex);
+    return finished && count == 0;
+}
+
+
+qint64 OdsInflatePipe::pos() const
+{
+    QMutexLocker locker(&mutex);
+    return bytesRead;
+}
+
+
+qint64 OdsInflatePipe::bytesAvailable() const
+{
+    QMutexLocker locker(&mutex);
+    qint64 lResult = 0;
+    for (int i = 0; i < count; i++)
+        lResult += chunks.at((head + i) % chunks.count()).size;
+    return lResult - readPos + QIODevice::bytesAvailable();
+}
+
+
+bool OdsInflatePipe::failed() const
+{
+    QMutexLocker locker(&mutex);
+    return error;
+}
+
+
+qint64 OdsInflatePipe::readData(char* data, qint64 maxSize)
+{
+    QMutexLocker locker(&mutex);
+
+    while (count == 0 && !finished)
+        notEmpty.wait(&mutex);
+
+    if (count == 0)
+        return error ? -1 : 0;
+
+    // Chunks from head to head + count - 1 are not touched by the producer
+    qint64 lResult = 0;
+    while (count > 0 && lResult < maxSize)
+    {
+        const Chunk& chunk = chunks.at(head);
+        const int n = int(qMin(qint64(chunk.size - readPos), maxSize - lResult));
+        memcpy(data + lResult, chunk.data.constData() + readPos, n);
+        lResult += n;
+        readPos += n;
+
+        if (readPos == chunk.size)
+        {
+            head = (head + 1) % chunks.count();
+            count--;
+            readPos = 0;
+            notFull.wakeOne();
+        }
+    }
+
+    bytesRead += lResult;
+    return lResult;
+}
+
+
+void OdsInflatePipe::produce()
+{
+    bool lResult = false;
+
+    QuaZip zip(fileName);
+    if (zip.open(QuaZip::mdUnzip) && zip.setCurrentFile(entryName))
+    {
+        QuaZipFile file(&zip);
+        if (file.open(QIODevice::ReadOnly))
+        {
+            forever
+            {
+                mutex.lock();
+                while (count == chunks.count() && !cancelled)
+                    notFull.wait(&mutex);
+                const int slot = (head + count) % chunks.count();
+                const bool stop = cancelled;
+                mutex.unlock();
+
+                if (stop)
+                {
+                    lResult = true;
+                    break;
+                }
+
+                // The free slot belongs to this thread until it is counted
+                Chunk& chunk = chunks[slot];
+                const qint64 n = file.read(chunk.data.data(), chunk.data.size());
+                if (n <= 0)
+                {
+                    lResult = n == 0;
+                    break;
+                }
+                chunk.size = int(n);
+
+                mutex.lock();
+                count++;
+                notEmpty.wakeOne();
+                mutex.unlock();
+            }
+            file.close();
+        }
+        zip.close();
+    }
+
+    mutex.lock();
+    finished = true;
+    error = !lResult;
+    notEmpty.wakeAll();
+    mutex.unlock();
+}
@@ -0,0 +1,71 @@
+#ifndef OdsInflatePipe_H
+#define OdsInflatePipe_H
+
+#include <QtCore/QIODevice>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QVector>
+
+
+// Sequential device that inflates one entry of a ZIP archive on its own
+// thread. Inflated data goes through a fixed ring of chunks, so the reader
+// can parse while the rest of the entry is still being decompressed and
+// never more than chunkCount * chunkSize bytes are held in memory.
+// Reads block until data arrives or the entry ends.
+class OdsInflatePipe : public QIODevice
+{
+public:
+    OdsInflatePipe(const QString& fileName, const QString& entryName, int chunkSize = 256 * 1024, int chunkCount = 8);
+    ~OdsInflatePipe();
+
+    bool        open(OpenMode mode) override;
+    void        close() override;
+    bool        isSequential() const override   { return true; }
+    bool        atEnd() const override;
+    qint64      pos() const override;           // bytes read from the entry so far
+    qint64      bytesAvailable() const override;
+    bool        failed() const;
+
+protected:
+    qint64      readData(char* data, qint64 maxSize) override;
+    qint64      writeData(const char*, qint64) override     { return -1; }
+
+private:
+    Q_DISABLE_COPY(OdsInflatePipe)
+
+    struct Chunk
+    {
+        QByteArray  data;
+        int         size;
+    };
+
+    class Producer : public QThread
+    {
+    public:
+        explicit Producer(OdsInflatePipe* pipe) : pipe(pipe) {}
+    protected:
+        void run() override                         { pipe->produce(); }
+    private:
+        OdsInflatePipe* pipe;
+    };
+
+    void                produce();
+
+    QString             fileName;
+    QString             entryName;
+    QVector<Chunk>      chunks;
+    int                 head;           // chunk being read
+    int                 count;          // chunks filled and not read yet
+    int                 readPos;        // read position in the head chunk
+    qint64              bytesRead;
+    bool                finished;       // producer has filled its last chunk
+    bool                error;
+    bool                cancelled;
+    mutable QMutex      mutex;
+    QWaitCondition      notEmpty;
+    QWaitCondition      notFull;
+    Producer            producer;
+};
+
+#endif // OdsInflatePipe_H
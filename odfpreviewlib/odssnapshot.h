@@ -0,0 +1,101 @@
+#ifndef OdsSnapshot_H
+#define OdsSnapshot_H
+
+#include <QtCore/qglobal.h>
+
+
+// Binary snapshot of an opened document, written by saveSnapshot() and
+// mapped by openSnapshot(). The file starts with SnapshotHeader, sections
+// follow at the offsets of its section table, each aligned to 8 bytes.
+// Nothing in the file is a pointer, so it can be mapped at any address.
+// Data is in the byte order and record layout of the writer; readers
+// check byteOrder and the record sizes and reject files they can't map.
+
+#define OdsSnapshot_MAGIC   0x4f445353      // "ODSS"
+#define OdsSnapshot_FORMAT  1               // changes with any change of the layout
+
+
+enum SnapshotSectionId
+{
+    snapshotStrings,                // UTF-16 pool of style, font and master page names
+    snapshotNameOffsets,            // quint32 per style id + 1, style name of id i is [offsets[i], offsets[i + 1])
+    snapshotStyles,                 // SnapshotStyle per style id
+    snapshotColumnStyle,            // quint32 arrays of SheetModel
+    snapshotColumnDefaultCellStyle,
+    snapshotColumnRepeat,
+    snapshotRowStyle,
+    snapshotRowRepeat,
+    snapshotRowFirstCell,
+    snapshotText,                   // UTF-16 text pool
+    snapshotCellTextOffset,
+    snapshotCellStyle,
+    snapshotCellRowSpan,
+    snapshotCellColumnSpan,
+    snapshotCellRepeat,
+    snapshotCellFlags,              // quint8 per cell
+    snapshotRowRuns,                // RowPos per row run
+    snapshotColumnRuns,             // ColumnPos per column run
+    snapshotPages,                  // SheetPage per page
+    snapshotPageStyle,              // one PageStyle, of the first table
+    snapshotSectionCount
+};
+
+
+struct SnapshotSection
+{
+    quint64     offset;             // from the start of the file
+    quint64     size;               // in bytes
+};
+
+
+struct SnapshotBorder
+{
+    double      size;
+    qint32      type;               // Qt::PenStyle
+    quint32     color;              // QRgb
+};
+
+
+// CellStyle without the objects cached for drawing. Names are ranges of
+// the string pool counted in QChars.
+struct SnapshotStyle
+{
+    qint32          type;           // StyleFamily
+    qint32          fontSize;
+    double          width;
+    double          height;
+    quint32         fontName;
+    quint32         fontNameSize;
+    quint32         masterPageName;
+    quint32         masterPageNameSize;
+    qint32          align;          // Qt::Alignment
+    quint32         backgroundColor;
+    qint32          breakBefore;
+    qint32          reserved;
+    SnapshotBorder  leftBS;
+    SnapshotBorder  rightBS;
+    SnapshotBorder  topBS;
+    SnapshotBorder  bottomBS;
+};
+
+
+struct SnapshotHeader
+{
+    quint32         magic;
+    quint32         format;
+    quint32         version;        // OdfPreviewLib_VERSION of the writer
+    quint32         byteOrder;      // 0x01020304 written in the order of the writer
+    quint32         styleSize;      // sizeof(SnapshotStyle)
+    quint32         pageStyleSize;  // sizeof(PageStyle)
+    quint32         rowRunSize;     // sizeof(RowPos)
+    quint32         columnRunSize;  // sizeof(ColumnPos)
+    quint32         pageSize;       // sizeof(SheetPage)
+    qint32          type;           // DocType
+    quint32         tableStyle;
+    qint32          usedRowRuns;
+    quint32         usedColumns;
+    quint32         reserved;
+    SnapshotSection sections[snapshotSectionCount];
+};
+
+#endif // OdsSnapshot_H
@@ -24,6 +24,8 @@ quazip/(un)zip.h files for details, basically it's zlib license.
 
 #include "quazipfile.h"
 
+#include <QFile>
+
 using namespace std;
 
 /// The implementation class for QuaZip.
@@ -464,6 +466,32 @@ bool QuaZipFile::getFileInfo(QuaZipFileInfo64 *info)
     return p->zipError==UNZ_OK;
 }
 
+QByteArray QuaZipFile::mapStored()
+{
+  unz_file_info64 info_z;
+  p->setZipError(UNZ_OK);
+  if(p->zip==NULL||p->zip->getMode()!=QuaZip::mdUnzip||!isOpen()) return QByteArray();
+  p->setZipError(unzGetCurrentFileInfo64(p->zip->getUnzFile(), &info_z, NULL, 0, NULL, 0, NULL, 0));
+  if(p->zipError!=UNZ_OK)
+    return QByteArray();
+  // only data that is not compressed or encrypted can be used in place
+  if(info_z.compression_method!=0||(info_z.flag&1)!=0)
+    return QByteArray();
+  QFile *file=qobject_cast<QFile*>(p->zip->getIoDevice());
+  if(file==NULL)
+    return QByteArray();
+  qint64 size=static_cast<qint64>(info_z.uncompressed_size);
+  if(size>0x7fffffff)
+    return QByteArray();
+  if(size==0)
+    return QByteArray("");
+  // the mapping belongs to the archive file and is released when it closes
+  uchar *data=file->map(unzGetCurrentFileZStreamPos64(p->zip->getUnzFile()), size);
+  if(data==NULL)
+    return QByteArray();
+  return QByteArray::fromRawData(reinterpret_cast<const char*>(data), static_cast<int>(size));
+}
+
 void QuaZipFile::close()
 {
   p->resetZipError();
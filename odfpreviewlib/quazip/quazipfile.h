@@ -443,6 +443,19 @@ class QUAZIP_EXPORT QuaZipFile: public QIODevice {
      * \sa getFileInfo(QuaZipFileInfo*)
      */
     bool getFileInfo(QuaZipFileInfo64 *info);
+    /// Maps a stored file into memory.
+    /** If the current file is stored without compression and encryption
+     * and the archive is a QFile, returns a zero-copy view of its data
+     * mapped with QFile::map(). Otherwise returns a null QByteArray and
+     * the file has to be read as usual.
+     *
+     * File must be open for reading and nothing must have been read from
+     * it yet.
+     *
+     * The returned array does not own its data. It stays valid until the
+     * associated QuaZip is closed.
+     **/
+    QByteArray mapStored();
     /// Closes the file.
     /** Call getZipError() to determine if the close was successful.
      **/
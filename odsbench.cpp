@@ -0,0 +1,119 @@
+#include <QDebug>
+#include <QtCore/QFile>
+#include <QtCore/QtMath>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+#include <QtTest/QtTest>
+#include <QtXml/QDomDocument>
+
+#include "odfpreviewlib.h"
+#include "quazip/quazip.h"
+#include "quazip/quazipfile.h"
+
+
+// Draw time of a sheet made of the rows of nakl.ods repeated up to 100k
+// cells. Run it on two builds to compare them, e.g.
+//     odsbench -iterations 5
+class OdsBench : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void open();
+    void draw();
+    void drawDraft();
+
+private:
+    QDomDocument    content;
+    OdfPreviewLib   doc;
+    int             cells;
+};
+
+
+void OdsBench::initTestCase()
+{
+    QuaZip zip(ODSBENCH_DOCUMENT);
+    QVERIFY(zip.open(QuaZip::mdUnzip));
+    QVERIFY(zip.setCurrentFile("content.xml"));
+
+    QuaZipFile file(&zip);
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QVERIFY(content.setContent(file.readAll()));
+    file.close();
+    zip.close();
+
+    // Rows of the first table are appended again until there are 100k cells
+    QDomElement table = content.elementsByTagName("table:table").at(0).toElement();
+    QVERIFY(!table.isNull());
+
+    QList<QDomElement> rows;
+    cells = 0;
+    for (QDomElement row = table.firstChildElement("table:table-row"); !row.isNull(); row = row.nextSiblingElement("table:table-row"))
+    {
+        rows.append(row);
+        cells += row.elementsByTagName("table:table-cell").count() + row.elementsByTagName("table:covered-table-cell").count();
+    }
+    QVERIFY(cells > 0);
+
+    const int rowCells = cells;
+    while (cells < 100000)
+    {
+        for (int i = 0; i < rows.count(); i++)
+            table.appendChild(rows.at(i).cloneNode(true));
+        cells += rowCells;
+    }
+
+    QVERIFY(doc.open(&content));
+    qDebug() << cells << "cells," << doc.pageCount() << "pages";
+}
+
+
+void OdsBench::open()
+{
+    QBENCHMARK
+    {
+        OdfPreviewLib scaled;
+        scaled.open(&content);
+    }
+}
+
+
+void OdsBench::draw()
+{
+    const QSizeF size = doc.pageSize();
+    QImage image(qCeil(size.width() * 96 / 25.4), qCeil(size.height() * 96 / 25.4), QImage::Format_ARGB32_Premultiplied);
+
+    QBENCHMARK
+    {
+        for (int page = 0; page < doc.pageCount(); page++)
+        {
+            image.fill(Qt::white);
+            QPainter painter(&image);
+            painter.setRenderHints(QPainter::Antialiasing | QPainter::TextAntialiasing, true);
+            doc.renderPage(&painter, page);
+        }
+    }
+}
+
+
+void OdsBench::drawDraft()
+{
+    const QSizeF size = doc.pageSize();
+    QImage image(qCeil(size.width() * 96 / 25.4), qCeil(size.height() * 96 / 25.4), QImage::Format_ARGB32_Premultiplied);
+
+    QBENCHMARK
+    {
+        for (int page = 0; page < doc.pageCount(); page++)
+        {
+            image.fill(Qt::white);
+            QPainter painter(&image);
+            doc.renderPage(&painter, page, true);
+        }
+    }
+}
+
+
+QTEST_MAIN(OdsBench)
+
+#include "odsbench.moc"
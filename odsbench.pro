@@ -0,0 +1,32 @@
+#-------------------------------------------------
+#
+# Draw time benchmark on nakl.ods scaled to 100k cells
+#
+#-------------------------------------------------
+
+QT       += core gui xml printsupport testlib
+
+TARGET = odsbench
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which has been marked as deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+# The bundled document, the benchmark is run from any directory
+DEFINES += ODSBENCH_DOCUMENT=\\\"$$PWD/nakl.ods\\\"
+
+SOURCES += \
+    odsbench.cpp
+
+
+
+win32: LIBS += -L$$PWD/odfpreviewlib -lodfpreviewlib -L$$PWD/odfpreviewlib/quazip -lquazip
+unix:  LIBS += -L$$PWD/odfpreviewlib -lodfpreviewlib -L$$PWD/odfpreviewlib/quazip -lquazip
+
+INCLUDEPATH += $$PWD/odfpreviewlib $$PWD/odfpreviewlib/quazip
+DEPENDPATH += $$PWD/odfpreviewlib
@@ -0,0 +1,179 @@
+#include <QDebug>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
+#include <QtCore/QRunnable>
+#include <QtCore/QSet>
+#include <QtCore/QTextStream>
+#include <QtCore/QThreadPool>
+#include <QtGui/QGuiApplication>
+
+#include "odfpreviewlib.h"
+
+
+struct ConvertOptions
+{
+    QString     outputDir;
+    bool        png;
+    int         dpi;
+};
+
+
+// Totals of the run, updated by all workers
+struct ConvertStats
+{
+    QMutex      mutex;
+    int         files;
+    int         failed;
+    int         pages;
+};
+
+
+class ConvertTask : public QRunnable
+{
+public:
+    ConvertTask(const QString& fileName, const QString& baseName, const ConvertOptions& options, ConvertStats* stats)
+        : fileName(fileName), baseName(baseName), options(options), stats(stats)
+    {
+    }
+
+    void run()
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        // One document per task, documents are never shared between threads
+        OdfPreviewLib doc;
+        bool lResult = doc.open(fileName);
+        const int pages = lResult ? doc.pageCount() : 0;
+
+        if (lResult)
+        {
+            if (options.png)
+            {
+                for (int page = 0; page < pages && lResult; page++)
+                {
+                    const QString pngName = pages == 1 ? baseName + ".png"
+                                                       : QString("%1-%2.png").arg(baseName).arg(page + 1);
+                    lResult = doc.renderToImage(page, options.dpi).save(pngName, "PNG");
+                }
+            }
+            else
+                lResult = doc.renderToPdf(baseName + ".pdf");
+        }
+        doc.close();
+
+        QMutexLocker locker(&stats->mutex);
+        stats->files++;
+        if (lResult)
+            stats->pages += pages;
+        else
+            stats->failed++;
+
+        QTextStream(stdout) << fileName << '\t' << pages << '\t' << timer.elapsed() << " ms\t"
+                            << (lResult ? "ok" : "FAILED") << endl;
+    }
+
+private:
+    QString             fileName;
+    QString             baseName;       // output file name without extension
+    ConvertOptions      options;
+    ConvertStats*       stats;
+};
+
+
+int main(int argc, char *argv[])
+{
+    // Fonts need a GUI application, but no display is required
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QGuiApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts ODF spreadsheets to PDF or PNG files.");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption(QStringList() << "f" << "format", "Output format: pdf (default) or png.", "format", "pdf"));
+    parser.addOption(QCommandLineOption(QStringList() << "o" << "output", "Output directory (default: current).", "dir", "."));
+    parser.addOption(QCommandLineOption(QStringList() << "j" << "jobs", "Number of worker threads (default: number of cores).", "n"));
+    parser.addOption(QCommandLineOption(QStringList() << "r" << "dpi", "Resolution of PNG files (default: 96).", "dpi", "96"));
+    parser.addPositionalArgument("files", "Files to convert, - reads file names from standard input.", "files...");
+    parser.process(a);
+
+    ConvertOptions options;
+    options.outputDir   = parser.value("output");
+    options.png         = parser.value("format") == "png";
+    options.dpi         = parser.value("dpi").toInt();
+
+    if (!options.png && parser.value("format") != "pdf")
+    {
+        qWarning() << "Unknown format:" << parser.value("format");
+        return 1;
+    }
+    if (options.dpi <= 0)
+        options.dpi = 96;
+    QDir().mkpath(options.outputDir);
+
+    QStringList files;
+    foreach (const QString& arg, parser.positionalArguments())
+    {
+        if (arg == "-")
+        {
+            QTextStream in(stdin);
+            while (!in.atEnd())
+            {
+                const QString line = in.readLine().trimmed();
+                if (!line.isEmpty())
+                    files.append(line);
+            }
+        }
+        else
+            files.append(arg);
+    }
+
+    if (files.isEmpty())
+        parser.showHelp(1);
+
+    // Bounded pool, at most jobs documents are open at the same time
+    QThreadPool pool;
+    if (parser.isSet("jobs") && parser.value("jobs").toInt() > 0)
+        pool.setMaxThreadCount(parser.value("jobs").toInt());
+
+    ConvertStats stats;
+    stats.files     = 0;
+    stats.failed    = 0;
+    stats.pages     = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Output names are taken from the input file names only, so a/x.ods and
+    // b/x.ods would write the same file from two threads. Only the first of
+    // them is converted, the others fail.
+    QSet<QString> outputs;
+    foreach (const QString& fileName, files)
+    {
+        const QString baseName = QDir(options.outputDir).filePath(QFileInfo(fileName).completeBaseName());
+        const QString key = QDir::cleanPath(QFileInfo(baseName).absoluteFilePath()).toCaseFolded();
+        if (outputs.contains(key))
+        {
+            QMutexLocker locker(&stats.mutex);
+            stats.files++;
+            stats.failed++;
+            QTextStream(stdout) << fileName << "\t0\t0 ms\tFAILED (output " << baseName << " already used)" << endl;
+            continue;
+        }
+        outputs.insert(key);
+        pool.start(new ConvertTask(fileName, baseName, options, &stats));
+    }
+    pool.waitForDone();
+
+    const qreal seconds = qMax(timer.elapsed(), qint64(1)) / 1000.0;
+    QTextStream(stdout) << stats.files << " files (" << stats.failed << " failed), " << stats.pages << " pages in "
+                        << seconds << " s: " << stats.files / seconds << " files/s, "
+                        << stats.pages / seconds << " pages/s" << endl;
+
+    return stats.failed > 0 ? 2 : 0;
+}
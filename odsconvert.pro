@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# Batch converter of ODF documents to PDF and PNG
+#
+#-------------------------------------------------
+
+QT       += core gui xml printsupport widgets
+
+TARGET = odsconvert
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+# The following define makes your compiler emit warnings if you use
+# any feature of Qt which has been marked as deprecated (the exact warnings
+# depend on your compiler). Please consult the documentation of the
+# deprecated API in order to know how to port your code away from it.
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+    odsconvert.cpp
+
+
+
+win32: LIBS += -L$$PWD/odfpreviewlib -lodfpreviewlib
+unix:  LIBS += -L$$PWD/odfpreviewlib -lodfpreviewlib
+
+INCLUDEPATH += $$PWD/odfpreviewlib
+DEPENDPATH += $$PWD/odfpreviewlib